@@ -0,0 +1,40 @@
+#!/bin/sh
+#
+# bench.sh - The benchmark matrix: mdriver built for every word size and
+# optimization, and run under every policy of the allocator, with the
+# total util and Kops/s of the default traces side by side.
+#
+# The matrix can be narrowed through the environment, e.g.
+#     WORDS=64 OPTS="O2 lto" sh bench.sh
+# A cell that cannot be built (no -m32 support, say) is reported and
+# skipped.  The "4 threads" column is the throughput of mdriver -j 4,
+# every thread replaying the traces at once in multithreaded mode.
+
+WORDS=${WORDS:-"32 64"}
+OPTS=${OPTS:-"O2 O3 lto"}
+MAKE=${MAKE:-make}
+
+# Print the util and Kops/s of the first Total line of mdriver's output
+totals() {
+    awk '$1 == "Total" { print $2, $NF; exit }'
+}
+
+printf "%-8s %-16s %-16s %-16s %s\n" build default "deferred (-d)" \
+    "ordered (-o)" "4 threads"
+printf "%-8s %-16s %-16s %-16s %s\n" "" "util    Kops" "util    Kops" \
+    "util    Kops" "Kops"
+for w in $WORDS; do
+    for o in $OPTS; do
+	driver=mdriver-$w-$o
+	if ! $MAKE -s -f Makefile.txt $driver >/dev/null 2>&1; then
+	    printf "%-8s (cannot be built here)\n" $w-$o
+	    continue
+	fi
+	printf "%-8s" $w-$o
+	for flags in "" -d -o; do
+	    ./$driver -a -v $flags | totals | \
+		(read util kops; printf " %-5s %-10s" "$util" "$kops")
+	done
+	./$driver -a -j 4 | awk '$1 == "Total" { print $6; exit }'
+    done
+done
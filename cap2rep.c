@@ -0,0 +1,418 @@
+/*
+ * cap2rep.c - Turn a capture log written by libcapture.so into a trace
+ *
+ * The records of the log are sorted into the order in which the
+ * requests were made, and every block gets a dense trace id, from its
+ * allocation until it is freed.  The ids of freed blocks are handed out
+ * again, so a trace has only as many ids as blocks are live at once,
+ * and mdriver -s replays it in memory for those, however long it is.
+ * The trace is written in the text .rep format, or with -b in the
+ * binary format that mdriver maps.
+ *
+ * A capture does not always see both ends of a block: blocks from
+ * before the capture started or from an allocator call that is not
+ * interposed get freed, and the requests threads make after exit has
+ * begun are lost.  Frees of unknown blocks are dropped, and a block
+ * that is handed out again while it still looks live is freed first.
+ * Requests of 0 bytes, failed requests and requests too large for the
+ * trace format are dropped as well.
+ *
+ * A realloc that moved its block comes in two halves.  The first takes
+ * the block's id off its old address, so that another thread can be
+ * handed that address, and the second puts the id on the new address.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include "capture.h"
+#include "trace.h"
+
+/*
+ * Open addressing hash table from the address of every live block to
+ * its trace id, with linear probing.  Address 0 marks an empty slot.
+ */
+typedef struct {
+    uint64_t addr;
+    int id;
+} slot_t;
+
+static slot_t *table = NULL;  /* the hash table */
+static size_t table_size = 0; /* number of slots, a power of 2 */
+static size_t table_used = 0; /* number of live blocks in it */
+
+/* The trace being built */
+static traceop_t *ops = NULL;
+static unsigned num_ops = 0;
+static unsigned max_ops = 0;
+static unsigned num_ids = 0;
+static long long live_bytes = 0, max_live_bytes = 0;
+static int *id_sizes = NULL;  /* current size of each id */
+static unsigned max_ids = 0;
+static int *free_ids = NULL;  /* stack of the ids of freed blocks */
+static unsigned num_free_ids = 0;
+
+/* The id each thread is moving in a realloc, MOVE_NONE if it is in no
+   realloc, or -1 if the block it moves is unknown */
+#define MOVE_NONE -2
+static int *moving = NULL;
+static unsigned max_threads = 0;
+
+/* Function prototypes for internal helper routines */
+static caprec_t *read_log(char *path, size_t *n);
+static int cmp_seq(const void *a, const void *b);
+static void replay(caprec_t *rec);
+static int *moving_of(unsigned thread);
+static int new_id(void);
+static void add_op(int type, int id, int size);
+static slot_t *lookup(uint64_t addr);
+static void insert(uint64_t addr, int id);
+static void delete(slot_t *s);
+static void write_text(char *path);
+static void write_binary(char *path);
+static void usage(void);
+static void unix_error(char *msg);
+
+int main(int argc, char **argv)
+{
+    caprec_t *rec;
+    size_t i, n;
+    int binary = 0;
+    int c;
+
+    while ((c = getopt(argc, argv, "bh")) != EOF) {
+	switch (c) {
+	case 'b': /* Write the binary format */
+	    binary = 1;
+	    break;
+	case 'h': /* Print this message */
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+    if (argc - optind != 2) {
+	usage();
+	exit(1);
+    }
+
+    /* Replay the requests in their order, skipping any record twice */
+    rec = read_log(argv[optind], &n);
+    qsort(rec, n, sizeof(caprec_t), cmp_seq);
+    for (i = 0; i < n; i++)
+	if (i == 0 || rec[i].seq != rec[i-1].seq)
+	    replay(&rec[i]);
+    free(rec);
+
+    if (binary)
+	write_binary(argv[optind + 1]);
+    else
+	write_text(argv[optind + 1]);
+    printf("%u requests on %u ids, %lld bytes live at most\n",
+	   num_ops, num_ids, max_live_bytes);
+    exit(0);
+}
+
+/*
+ * read_log - Read all the records of a capture log into memory
+ */
+static caprec_t *read_log(char *path, size_t *n)
+{
+    FILE *f;
+    caprec_t *rec = NULL;
+    size_t len = 0, max = 0;
+
+    if ((f = fopen(path, "r")) == NULL)
+	unix_error(path);
+    for (;;) {
+	if (len == max) {
+	    max = max ? 2 * max : (1 << 16);
+	    if ((rec = (caprec_t *)realloc(rec, max * sizeof(caprec_t))) == NULL)
+		unix_error("realloc failed in read_log");
+	}
+	if (fread(&rec[len], sizeof(caprec_t), 1, f) != 1)
+	    break;
+	len++;
+    }
+    fclose(f);
+    *n = len;
+    return rec;
+}
+
+static int cmp_seq(const void *a, const void *b)
+{
+    uint64_t x = ((const caprec_t *)a)->seq, y = ((const caprec_t *)b)->seq;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * replay - Turn one captured request into trace requests
+ */
+static void replay(caprec_t *rec)
+{
+    slot_t *s;
+    int type = rec->type;
+    int id, *m;
+
+    /* The first half of a moving realloc takes its id off the old address */
+    if (type == CAP_MOVE) {
+	id = -1;
+	if ((s = lookup(rec->ptr)) != NULL) {
+	    id = s->id;
+	    delete(s);
+	}
+	*moving_of(rec->thread) = id;
+	return;
+    }
+
+    /* The second half puts it on the new one, if it can be traced */
+    if (type == CAP_REALLOC && *(m = moving_of(rec->thread)) != MOVE_NONE) {
+	id = *m;
+	*m = MOVE_NONE;
+	if (id >= 0) {
+	    if (rec->result == 0 || rec->size == 0 || rec->size > INT_MAX) {
+		add_op(FREE, id, 0);
+		return;
+	    }
+	    if ((s = lookup(rec->result)) != NULL) {
+		add_op(FREE, s->id, 0);
+		delete(s);
+	    }
+	    insert(rec->result, id);
+	    add_op(REALLOC, id, rec->size);
+	    return;
+	}
+	type = CAP_MALLOC;
+    }
+
+    /* A realloc may really be a malloc or a free */
+    if (type == CAP_REALLOC) {
+	if (rec->ptr == 0 || lookup(rec->ptr) == NULL)
+	    type = CAP_MALLOC;
+	else if (rec->size == 0)
+	    type = CAP_FREE;
+    }
+    if (type != CAP_FREE && 
+	(rec->result == 0 || rec->size == 0 || rec->size > INT_MAX))
+	return;
+
+    switch (type) {
+    case CAP_MALLOC:
+	if ((s = lookup(rec->result)) != NULL) {
+	    add_op(FREE, s->id, 0);
+	    delete(s);
+	}
+	id = new_id();
+	insert(rec->result, id);
+	add_op(ALLOC, id, rec->size);
+	break;
+
+    case CAP_FREE:
+	if ((s = lookup(rec->ptr)) != NULL) {
+	    add_op(FREE, s->id, 0);
+	    delete(s);
+	}
+	break;
+
+    case CAP_REALLOC:
+	s = lookup(rec->ptr);
+	id = s->id;
+	delete(s);
+	if ((s = lookup(rec->result)) != NULL) {
+	    add_op(FREE, s->id, 0);
+	    delete(s);
+	}
+	insert(rec->result, id);
+	add_op(REALLOC, id, rec->size);
+	break;
+    }
+}
+
+/*
+ * moving_of - Return the entry of a thread in the moving array
+ */
+static int *moving_of(unsigned thread)
+{
+    unsigned i;
+
+    if (thread >= max_threads) {
+	i = max_threads;
+	while (thread >= max_threads)
+	    max_threads = max_threads ? 2 * max_threads : 64;
+	if ((moving = (int *)realloc(moving, max_threads * sizeof(int))) == NULL)
+	    unix_error("realloc failed in moving_of");
+	for (; i < max_threads; i++)
+	    moving[i] = MOVE_NONE;
+    }
+    return &moving[thread];
+}
+
+/*
+ * new_id - Return the id of a freed block, or a new one
+ */
+static int new_id(void)
+{
+    if (num_free_ids > 0)
+	return free_ids[--num_free_ids];
+    return num_ids++;
+}
+
+/*
+ * add_op - Append a request to the trace, and keep track of the
+ *     payload that is live and of the ids that are free
+ */
+static void add_op(int type, int id, int size)
+{
+    if (num_ops == max_ops) {
+	max_ops = max_ops ? 2 * max_ops : (1 << 16);
+	if ((ops = (traceop_t *)realloc(ops, max_ops * sizeof(traceop_t))) == NULL)
+	    unix_error("realloc failed in add_op");
+    }
+    if ((unsigned)id >= max_ids) {
+	max_ids = max_ids ? 2 * max_ids : (1 << 16);
+	if ((id_sizes = (int *)realloc(id_sizes, max_ids * sizeof(int))) == NULL ||
+	    (free_ids = (int *)realloc(free_ids, max_ids * sizeof(int))) == NULL)
+	    unix_error("realloc failed in add_op");
+    }
+    ops[num_ops].type = type;
+    ops[num_ops].index = id;
+    ops[num_ops].size = size;
+    num_ops++;
+
+    if (type != ALLOC)
+	live_bytes -= id_sizes[id];
+    id_sizes[id] = size;
+    live_bytes += size;
+    if (live_bytes > max_live_bytes)
+	max_live_bytes = live_bytes;
+    if (type == FREE)
+	free_ids[num_free_ids++] = id;
+}
+
+/*
+ * lookup - Return the slot of a live block, or NULL
+ */
+static slot_t *lookup(uint64_t addr)
+{
+    size_t i;
+
+    if (table_size == 0)
+	return NULL;
+    for (i = (addr >> 4) & (table_size - 1); table[i].addr != 0;
+	 i = (i + 1) & (table_size - 1))
+	if (table[i].addr == addr)
+	    return &table[i];
+    return NULL;
+}
+
+/*
+ * insert - Add a live block to the table, which must not hold it yet
+ */
+static void insert(uint64_t addr, int id)
+{
+    slot_t *old = table;
+    size_t i, old_size = table_size;
+
+    /* Keep the table at most half full */
+    if (2 * (table_used + 1) > table_size) {
+	table_size = table_size ? 2 * table_size : (1 << 16);
+	if ((table = (slot_t *)calloc(table_size, sizeof(slot_t))) == NULL)
+	    unix_error("calloc failed in insert");
+	table_used = 0;
+	for (i = 0; i < old_size; i++)
+	    if (old[i].addr != 0)
+		insert(old[i].addr, old[i].id);
+	free(old);
+    }
+
+    for (i = (addr >> 4) & (table_size - 1); table[i].addr != 0;
+	 i = (i + 1) & (table_size - 1))
+	;
+    table[i].addr = addr;
+    table[i].id = id;
+    table_used++;
+}
+
+/*
+ * delete - Remove a block from the table, moving back the blocks
+ *     after it that would not be found past the hole
+ */
+static void delete(slot_t *s)
+{
+    size_t i = s - table, j, home;
+
+    for (j = (i + 1) & (table_size - 1); table[j].addr != 0;
+	 j = (j + 1) & (table_size - 1)) {
+	home = (table[j].addr >> 4) & (table_size - 1);
+	if (((j - home) & (table_size - 1)) >= ((j - i) & (table_size - 1))) {
+	    table[i] = table[j];
+	    i = j;
+	}
+    }
+    table[i].addr = 0;
+    table_used--;
+}
+
+/*
+ * write_text - Write the trace in the .rep format
+ */
+static void write_text(char *path)
+{
+    FILE *f;
+    unsigned i;
+    static const char type[] = {'a', 'f', 'r'};
+
+    if ((f = fopen(path, "w")) == NULL)
+	unix_error(path);
+    fprintf(f, "%lld\n%u\n%u\n%d\n", 
+	    max_live_bytes < UINT_MAX ? max_live_bytes : UINT_MAX, 
+	    num_ids, num_ops, 1);
+    for (i = 0; i < num_ops; i++)
+	if (ops[i].type == FREE)
+	    fprintf(f, "f %d\n", ops[i].index);
+	else
+	    fprintf(f, "%c %d %d\n", type[ops[i].type], ops[i].index,
+		    ops[i].size);
+    if (fclose(f) != 0)
+	unix_error(path);
+}
+
+/*
+ * write_binary - Write the trace in the binary format
+ */
+static void write_binary(char *path)
+{
+    FILE *f;
+    binhdr_t hdr;
+
+    hdr.magic = BIN_MAGIC;
+    hdr.num_ids = num_ids;
+    hdr.num_ops = num_ops;
+    hdr.weight = 1;
+    if ((f = fopen(path, "w")) == NULL)
+	unix_error(path);
+    if (fwrite(&hdr, sizeof(hdr), 1, f) != 1 ||
+	fwrite(ops, sizeof(traceop_t), num_ops, f) != num_ops ||
+	fclose(f) != 0)
+	unix_error(path);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: cap2rep [-hb] <capture log> <trace file>\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-b         Write the binary trace format.\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+}
+
+static void unix_error(char *msg)
+{
+    perror(msg);
+    exit(1);
+}
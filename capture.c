@@ -0,0 +1,415 @@
+/*
+ * capture.c - Capture the malloc requests of a real program
+ *
+ * Built as libcapture.so and loaded with LD_PRELOAD, this library
+ * interposes malloc, free, realloc and calloc and logs every request to
+ * a capture log, without changing what the program sees:
+ *
+ *     MM_CAPTURE=/tmp/app LD_PRELOAD=./libcapture.so app
+ *     ./cap2rep /tmp/app.<pid>.log app.rep
+ *
+ * Each thread writes records into a buffer of its own, so logging a
+ * request takes no lock.  Full buffers are pushed on a lock-free stack,
+ * and a flusher thread writes them to the log every few milliseconds.
+ * What made the order of two requests in different threads matter is
+ * the allocator's own locking, so one global counter, taken before
+ * freeing and after allocating, gives every request its place.  A
+ * realloc that moves its block does both, and is logged in two halves.  The
+ * log is left as raw records, and cap2rep sorts them and turns
+ * addresses into trace ids offline.
+ *
+ * Children created by fork are not captured.  An exec'd program is
+ * captured on its own, into a log named after its own pid.
+ */
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "capture.h"
+
+#define CAP_RECS     (1 << 15)  /* records in a thread buffer */
+#define CAP_THREADS  1024       /* threads whose buffers are flushed at exit */
+#define FLUSH_NSECS  10000000   /* the flusher wakes up every 10 ms */
+#define BOOT_SIZE    (1 << 16)  /* bytes for allocations made by dlsym */
+
+#define MIN(x, y) ((x) < (y) ? (x) : (y))
+
+/* TLS that is reached without a call to __tls_get_addr, which may malloc */
+#define TLS_IE __attribute__((tls_model("initial-exec")))
+
+/* A buffer of records, written by one thread */
+typedef struct capbuf_t {
+    struct capbuf_t *next;   /* next buffer on the stack of full ones */
+    unsigned count;          /* records written so far */
+    caprec_t rec[CAP_RECS];
+} capbuf_t;
+
+/* The allocator being interposed */
+static void *(*real_malloc)(size_t);
+static void (*real_free)(void *);
+static void *(*real_realloc)(void *, size_t);
+static void *(*real_calloc)(size_t, size_t);
+static int resolving = 0;    /* set while dlsym looks them up */
+
+/* Allocations made by dlsym itself.  Each has 16 bytes in front of it,
+   whose last word holds its size. */
+static char boot_heap[BOOT_SIZE] __attribute__((aligned(16)));
+static size_t boot_used = 0;
+
+/* Global state of the capture */
+static uint64_t next_seq = 0;        /* position of the next request */
+static unsigned next_thread = 0;     /* number of the next new thread */
+static capbuf_t *full_bufs = NULL;   /* stack of buffers to be written */
+static capbuf_t *cur_bufs[CAP_THREADS]; /* current buffer of each thread */
+static int capturing = 0;            /* cleared in forked children */
+static int closed = 0;               /* set once the log is complete */
+static int log_fd = -1;
+static pthread_mutex_t flush_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t exit_key;
+
+/* State of each thread */
+static __thread capbuf_t *my_buf TLS_IE = NULL;  /* buffer being written */
+static __thread unsigned my_thread TLS_IE = 0;   /* thread number + 1 */
+static __thread int in_shim TLS_IE = 0;          /* don't log requests */
+
+/* Function prototypes for internal helper routines */
+static void resolve(void);
+static void *boot_malloc(size_t size);
+static int is_boot(void *ptr);
+static uint64_t take_seq(void);
+static void log_request(uint64_t seq, uint32_t type, void *ptr, void *result,
+			size_t size);
+static capbuf_t *new_buf(void);
+static void push_full(capbuf_t *b);
+static void flush_full(void);
+static void write_buf(capbuf_t *b, unsigned count);
+static void *flusher(void *arg);
+static void thread_exit(void *arg);
+static void capture_exit(void);
+static void fork_child(void);
+
+/*
+ * capture_init - Open the log and start the flusher, before main
+ */
+__attribute__((constructor))
+static void capture_init(void)
+{
+    char path[4096];
+    const char *prefix;
+    pthread_t tid;
+
+    in_shim = 1;
+    if (real_malloc == NULL)
+	resolve();
+    if ((prefix = getenv(CAP_ENV)) == NULL)
+	prefix = "mm-capture";
+    snprintf(path, sizeof(path), "%s.%d.log", prefix, (int)getpid());
+    if ((log_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+	in_shim = 0;
+	return;
+    }
+    pthread_key_create(&exit_key, thread_exit);
+    pthread_atfork(NULL, NULL, fork_child);
+    atexit(capture_exit);
+    if (pthread_create(&tid, NULL, flusher, NULL) == 0)
+	pthread_detach(tid);
+    __atomic_store_n(&capturing, 1, __ATOMIC_RELEASE);
+    in_shim = 0;
+}
+
+/*
+ * The interposed allocator functions
+ */
+void *malloc(size_t size)
+{
+    void *p;
+
+    if (real_malloc == NULL) {
+	if (resolving)
+	    return boot_malloc(size);
+	resolve();
+    }
+    p = real_malloc(size);
+    log_request(take_seq(), CAP_MALLOC, NULL, p, size);
+    return p;
+}
+
+void free(void *ptr)
+{
+    if (ptr == NULL || is_boot(ptr))
+	return;
+    if (real_free == NULL)
+	resolve();
+    log_request(take_seq(), CAP_FREE, ptr, NULL, 0);
+    real_free(ptr);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    void *p;
+    uint64_t seq;
+
+    if (real_realloc == NULL) {
+	if (resolving)
+	    return boot_malloc(size);
+	resolve();
+    }
+    if (is_boot(ptr)) {
+	if ((p = malloc(size)) != NULL)
+	    memcpy(p, ptr, MIN(((size_t *)ptr)[-1], size));
+	return p;
+    }
+    /* The old block may be freed in the call, the new one allocated */
+    seq = take_seq();
+    p = real_realloc(ptr, size);
+    if (ptr != NULL && p != NULL && p != ptr) {
+	log_request(seq, CAP_MOVE, ptr, NULL, size);
+	log_request(take_seq(), CAP_REALLOC, ptr, p, size);
+    }
+    else
+	log_request(ptr == NULL ? take_seq() : seq, CAP_REALLOC, ptr, p, size);
+    return p;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *p;
+
+    if (real_calloc == NULL) {
+	if (resolving)
+	    return boot_malloc(nmemb * size); /* boot_heap is zeroed */
+	resolve();
+    }
+    p = real_calloc(nmemb, size);
+    if (size == 0 || nmemb <= SIZE_MAX / size)
+	log_request(take_seq(), CAP_MALLOC, NULL, p, nmemb * size);
+    return p;
+}
+
+/*
+ * resolve - Look up the allocator functions that come after us
+ */
+static void resolve(void)
+{
+    resolving = 1;
+    real_malloc = (void *(*)(size_t))dlsym(RTLD_NEXT, "malloc");
+    real_free = (void (*)(void *))dlsym(RTLD_NEXT, "free");
+    real_realloc = (void *(*)(void *, size_t))dlsym(RTLD_NEXT, "realloc");
+    real_calloc = (void *(*)(size_t, size_t))dlsym(RTLD_NEXT, "calloc");
+    resolving = 0;
+    if (!real_malloc || !real_free || !real_realloc || !real_calloc)
+	abort();
+}
+
+/*
+ * boot_malloc - Allocate from boot_heap, for dlsym.  These blocks are
+ *     never freed or logged.
+ */
+static void *boot_malloc(size_t size)
+{
+    char *p = boot_heap + boot_used + 16;
+    size_t len = (size + 16 + 15) & ~(size_t)15;
+
+    if (size > BOOT_SIZE || len > BOOT_SIZE - boot_used)
+	return NULL;
+    boot_used += len;
+    ((size_t *)p)[-1] = size;
+    return p;
+}
+
+static int is_boot(void *ptr)
+{
+    return (char *)ptr >= boot_heap && (char *)ptr < boot_heap + BOOT_SIZE;
+}
+
+/*
+ * take_seq - Take the position of a request among those of all threads
+ */
+static uint64_t take_seq(void)
+{
+    return __atomic_fetch_add(&next_seq, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * log_request - Append a request, at position seq, to the buffer of
+ *     this thread
+ */
+static void log_request(uint64_t seq, uint32_t type, void *ptr, void *result,
+			size_t size)
+{
+    capbuf_t *b = my_buf;
+    caprec_t *r;
+
+    if (in_shim || !__atomic_load_n(&capturing, __ATOMIC_ACQUIRE))
+	return;
+    in_shim = 1;
+
+    /* The first request of a thread gives it a number */
+    if (my_thread == 0) {
+	my_thread = __atomic_add_fetch(&next_thread, 1, __ATOMIC_RELAXED);
+	pthread_setspecific(exit_key, (void *)1);
+    }
+    if (b == NULL) {
+	if ((b = new_buf()) == NULL) {
+	    in_shim = 0;
+	    return;
+	}
+	my_buf = b;
+	if (my_thread <= CAP_THREADS)
+	    __atomic_store_n(&cur_bufs[my_thread - 1], b, __ATOMIC_RELEASE);
+    }
+
+    r = &b->rec[b->count];
+    r->seq = seq;
+    r->ptr = (uintptr_t)ptr;
+    r->result = (uintptr_t)result;
+    r->size = size;
+    r->type = type;
+    r->thread = my_thread - 1;
+    __atomic_store_n(&b->count, b->count + 1, __ATOMIC_RELEASE);
+
+    if (b->count == CAP_RECS) {
+	my_buf = NULL;
+	if (my_thread <= CAP_THREADS)
+	    __atomic_store_n(&cur_bufs[my_thread - 1], NULL, __ATOMIC_RELEASE);
+	push_full(b);
+    }
+    in_shim = 0;
+}
+
+/*
+ * new_buf - Map a new, empty buffer
+ */
+static capbuf_t *new_buf(void)
+{
+    void *p = mmap(NULL, sizeof(capbuf_t), PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    return (p == MAP_FAILED) ? NULL : (capbuf_t *)p;
+}
+
+/*
+ * push_full - Hand a buffer to the flusher
+ */
+static void push_full(capbuf_t *b)
+{
+    capbuf_t *top = __atomic_load_n(&full_bufs, __ATOMIC_RELAXED);
+
+    do
+	b->next = top;
+    while (!__atomic_compare_exchange_n(&full_bufs, &top, b, 1,
+					__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/*
+ * flush_full - Write every buffer handed to the flusher to the log
+ */
+static void flush_full(void)
+{
+    capbuf_t *b, *next;
+
+    pthread_mutex_lock(&flush_lock);
+    if (!closed) {
+	b = __atomic_exchange_n(&full_bufs, NULL, __ATOMIC_ACQUIRE);
+	for (; b != NULL; b = next) {
+	    next = b->next;
+	    write_buf(b, b->count);
+	    munmap(b, sizeof(capbuf_t));
+	}
+    }
+    pthread_mutex_unlock(&flush_lock);
+}
+
+/*
+ * write_buf - Write the first count records of a buffer to the log
+ */
+static void write_buf(capbuf_t *b, unsigned count)
+{
+    char *p = (char *)b->rec;
+    size_t left = count * sizeof(caprec_t);
+    ssize_t n;
+
+    while (left > 0) {
+	if ((n = write(log_fd, p, left)) <= 0)
+	    return;
+	p += n;
+	left -= n;
+    }
+}
+
+/*
+ * flusher - The thread that writes full buffers in the background
+ */
+static void *flusher(void *arg)
+{
+    struct timespec ts = {0, FLUSH_NSECS};
+
+    (void)arg;
+    in_shim = 1;
+    for (;;) {
+	nanosleep(&ts, NULL);
+	flush_full();
+    }
+    return NULL;
+}
+
+/*
+ * thread_exit - Hand the buffer of an exiting thread to the flusher.
+ *     Requests made by the destructors that run after this one are not
+ *     logged.
+ */
+static void thread_exit(void *arg)
+{
+    capbuf_t *b = my_buf;
+
+    (void)arg;
+    in_shim = 1;
+    if (b == NULL)
+	return;
+    my_buf = NULL;
+    if (my_thread <= CAP_THREADS)
+	__atomic_store_n(&cur_bufs[my_thread - 1], NULL, __ATOMIC_RELEASE);
+    push_full(b);
+}
+
+/*
+ * capture_exit - Complete the log when the program exits.  The buffers
+ *     of the threads that are still running are written as far as they
+ *     have got, and nothing is logged after that.
+ */
+static void capture_exit(void)
+{
+    capbuf_t *b;
+    int i, n;
+
+    in_shim = 1;
+    __atomic_store_n(&capturing, 0, __ATOMIC_RELEASE);
+    flush_full();
+
+    pthread_mutex_lock(&flush_lock);
+    n = __atomic_load_n(&next_thread, __ATOMIC_RELAXED);
+    for (i = 0; i < n && i < CAP_THREADS; i++)
+	if ((b = __atomic_load_n(&cur_bufs[i], __ATOMIC_ACQUIRE)) != NULL)
+	    write_buf(b, __atomic_load_n(&b->count, __ATOMIC_ACQUIRE));
+    closed = 1;
+    close(log_fd);
+    pthread_mutex_unlock(&flush_lock);
+}
+
+/*
+ * fork_child - Stop capturing in a child, which shares our log
+ */
+static void fork_child(void)
+{
+    capturing = 0;
+    closed = 1;
+}
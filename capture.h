@@ -0,0 +1,30 @@
+/* 
+ * Records of a capture log, as written by the LD_PRELOAD capture
+ * library (capture.c) and turned into a trace by cap2rep
+ */
+
+/* Name of the environment variable with the prefix of the log file */
+#define CAP_ENV "MM_CAPTURE"
+
+/* Types of captured requests */
+#define CAP_MALLOC  0  /* malloc or calloc */
+#define CAP_FREE    1
+#define CAP_REALLOC 2
+#define CAP_MOVE    3  /* first half of a realloc that moved its block */
+
+/* 
+ * One captured request.  The log is a sequence of these, in no order.
+ * A realloc that moves its block frees the old block before it
+ * allocates the new one, and another thread may be handed the old
+ * block in between.  So it is logged in two halves: a CAP_MOVE record
+ * of the old block, whose seq is taken before the call, and the
+ * CAP_REALLOC record, whose seq is taken after it.
+ */
+typedef struct {
+    uint64_t seq;     /* position of the request among those of all threads */
+    uint64_t ptr;     /* block passed to free or realloc */
+    uint64_t result;  /* block returned by malloc or realloc */
+    uint64_t size;    /* size requested from malloc or realloc */
+    uint32_t type;    /* CAP_MALLOC, CAP_FREE, CAP_REALLOC or CAP_MOVE */
+    uint32_t thread;  /* number of the thread, in order of its first request */
+} caprec_t;
@@ -58,15 +58,24 @@
 #define ALIGNMENT 8
 
 /* 
- * Maximum heap size in bytes 
+ * Address space reserved for each arena of the heap, in bytes.  Pages are
+ * committed only as they are used, and the heap opens another arena when
+ * one is full, so this does not bound the heap size.
  */
-#define MAX_HEAP (20*(1<<20))  /* 20 MB */
+#define ARENA_SIZE ((size_t)1 << (sizeof(void *) == 8 ? 32 : 26)) /* 4 GB or 64 MB */
 
 /*****************************************************************************
  * Set exactly one of these USE_xxx constants to "1" to select a timing method
  *****************************************************************************/
 #define USE_FCYC   0   /* cycle counter w/K-best scheme (x86 & Alpha only) */
 #define USE_ITIMER 0   /* interval timer (any Unix box) */
-#define USE_GETTOD 1   /* gettimeofday (any Unix box) */
+#define USE_GETTOD 0   /* gettimeofday (any Unix box) */
+#define USE_CLOCK  1   /* clock_gettime w/outlier rejection (any POSIX box) */
+
+/*
+ * Number of timed runs of each trace with USE_CLOCK.  The spread of
+ * their mean shrinks with the square root of this.
+ */
+#define CLOCK_RUNS 25
 
 #endif /* __CONFIG_H */
@@ -36,6 +36,10 @@ void init_fsecs(void)
 #elif USE_GETTOD
     if (verbose)
 	printf("Measuring performance with gettimeofday().\n");
+#elif USE_CLOCK
+    if (verbose)
+	printf("Measuring performance with clock_gettime(), %d runs.\n",
+	       CLOCK_RUNS);
 #endif
 }
 
@@ -44,6 +48,25 @@ void init_fsecs(void)
  */
 double fsecs(fsecs_test_funct f, void *argp) 
 {
+    return fsecs_ci(f, argp, 1, NULL);
+}
+
+/*
+ * fsecs_ci - Return the running time of a function f (in seconds), and
+ *     set *ci (unless ci is NULL) to the half-width of the 95% confidence
+ *     interval of that time, or to 0 if the timing method gives none.
+ *     With pin set, the timing method may keep the calling thread on one
+ *     CPU; a function that starts threads of its own should not be timed
+ *     so, as the threads would be kept on that CPU as well.
+ */
+double fsecs_ci(fsecs_test_funct f, void *argp, int pin, double *ci)
+{
+#if USE_CLOCK
+    return ftimer_clock(f, argp, CLOCK_RUNS, pin, ci);
+#else
+    pin = pin; /* keep gcc -Wall happy */
+    if (ci != NULL)
+	*ci = 0;
 #if USE_FCYC
     double cycles = fcyc(f, argp);
     return cycles/(Mhz*1e6);
@@ -52,6 +75,7 @@ double fsecs(fsecs_test_funct f, void *argp)
 #elif USE_GETTOD
     return ftimer_gettod(f, argp, 10);
 #endif 
+#endif
 }
 
 
@@ -7,14 +7,36 @@
  * Function timers that estimate the running time (in seconds) of a function f.
  *    ftimer_itimer: version that uses the interval timer
  *    ftimer_gettod: version that uses gettimeofday
+ *    ftimer_clock: version that uses clock_gettime, with statistics
  */
+#define _GNU_SOURCE
+#include <math.h>
+#include <sched.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <sys/time.h>
 #include "ftimer.h"
 
+/* The raw monotonic clock is not slewed by NTP, where there is one */
+#ifdef CLOCK_MONOTONIC_RAW
+#define FTIMER_CLOCK CLOCK_MONOTONIC_RAW
+#else
+#define FTIMER_CLOCK CLOCK_MONOTONIC
+#endif
+
+/* Runs of ftimer_clock that are not timed, and how far from the median,
+   in robust standard deviations, a run may be and still be kept */
+#define WARMUP_RUNS 2
+#define OUTLIER_SDS 3.0
+
 /* function prototypes */
 static void init_etime(void);
 static double get_etime(void);
+static double clock_secs(void);
+static int cmp_double(const void *a, const void *b);
+static double t_quantile(int df);
 
 /* 
  * ftimer_itimer - Use the interval timer to estimate the running time
@@ -53,6 +75,111 @@ double ftimer_gettod(ftimer_test_funct f, void *argp, int n)
 }
 
 
+/* 
+ * ftimer_clock - Use clock_gettime to estimate the running time of
+ * f(argp).  Return the mean of n runs once outliers are rejected.
+ *
+ * A run is an outlier when it is more than OUTLIER_SDS robust standard
+ * deviations from the median, the robust standard deviation being the
+ * median absolute deviation scaled to match the standard deviation of
+ * a normal distribution.  A timer interrupt or a migration makes a run
+ * slow, not fast, so this mostly drops slow runs.  The confidence
+ * interval of the mean of the runs kept uses Student's t.
+ */
+double ftimer_clock(ftimer_test_funct f, void *argp, int n, int pin, double *ci)
+{
+    double *t, *dev, start, med, mad, mean, var;
+    int i, kept;
+#ifdef __linux__
+    cpu_set_t old_set, set;
+    int cpu;
+
+    /* Stay on the CPU the thread is on, so that the runs share caches */
+    pin = pin && sched_getaffinity(0, sizeof(old_set), &old_set) == 0 &&
+	(cpu = sched_getcpu()) >= 0;
+    if (pin) {
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	pin = sched_setaffinity(0, sizeof(set), &set) == 0;
+    }
+#endif
+
+    if ((t = (double *)malloc(2 * n * sizeof(double))) == NULL) {
+	fprintf(stderr, "malloc failed in ftimer_clock\n");
+	exit(1);
+    }
+    dev = t + n;
+    for (i = 0; i < WARMUP_RUNS; i++)
+	f(argp);
+    for (i = 0; i < n; i++) {
+	start = clock_secs();
+	f(argp);
+	t[i] = clock_secs() - start;
+    }
+
+#ifdef __linux__
+    if (pin)
+	sched_setaffinity(0, sizeof(old_set), &old_set);
+#endif
+
+    /* The median and the median absolute deviation */
+    qsort(t, n, sizeof(double), cmp_double);
+    med = (t[(n - 1) / 2] + t[n / 2]) / 2;
+    for (i = 0; i < n; i++)
+	dev[i] = fabs(t[i] - med);
+    qsort(dev, n, sizeof(double), cmp_double);
+    mad = 1.4826 * (dev[(n - 1) / 2] + dev[n / 2]) / 2;
+
+    /* Mean and variance of the runs kept */
+    mean = var = 0;
+    kept = 0;
+    for (i = 0; i < n; i++)
+	if (fabs(t[i] - med) <= OUTLIER_SDS * mad) {
+	    t[kept++] = t[i];
+	    mean += t[i];
+	}
+    mean /= kept;
+    for (i = 0; i < kept; i++)
+	var += (t[i] - mean) * (t[i] - mean);
+    if (ci != NULL)
+	*ci = kept > 1 ? t_quantile(kept - 1) * sqrt(var / (kept - 1) / kept) : 0;
+    free(t);
+    return mean;
+}
+
+/*
+ * Helpers of ftimer_clock
+ */
+
+/* Return the time of the clock in seconds */
+static double clock_secs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(FTIMER_CLOCK, &ts);
+    return ts.tv_sec + 1E-9 * ts.tv_nsec;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/* Return the 97.5% quantile of Student's t distribution with df degrees
+   of freedom, which gives a 95% confidence interval */
+static double t_quantile(int df)
+{
+    static const double t[] = {
+	12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+	2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+	2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+    };
+
+    return df <= 30 ? t[df - 1] : 1.96;
+}
+
 /*
  * Routines for manipulating the Unix interval timer
  */
@@ -12,3 +12,10 @@ double ftimer_itimer(ftimer_test_funct f, void *argp, int n);
    Return the average of n runs */
 double ftimer_gettod(ftimer_test_funct f, void *argp, int n);
 
+
+/* Estimate the running time of f(argp) using clock_gettime, after two
+   runs to warm up.  Times n runs, rejects the outliers among them, and
+   returns the mean of the rest; sets *ci (unless ci is NULL) to the
+   half-width of the 95% confidence interval of that mean.  With pin
+   set, the calling thread is kept on one CPU while it is timed. */
+double ftimer_clock(ftimer_test_funct f, void *argp, int n, int pin, double *ci);
@@ -15,12 +15,20 @@
 #include <string.h>
 #include <assert.h>
 #include <float.h>
+#include <math.h>
 #include <time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "mm.h"
 #include "memlib.h"
 #include "fsecs.h"
+#include "ftimer.h"
+#include "clock.h"
 #include "config.h"
+#include "trace.h"
 
 /**********************
  * Constants and macros
@@ -31,6 +39,14 @@
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
 
+/* A streamed trace is read and replayed this many requests at a time */
+#define STREAM_OPS  (1 << 16)
+
+/* Latency histograms have LAT_SUB buckets per power of two of cycles */
+#define LAT_SUB_BITS 2
+#define LAT_SUB      (1 << LAT_SUB_BITS)
+#define LAT_BUCKETS  (64 * LAT_SUB)
+
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((uintptr_t)(p)) % ALIGNMENT) == 0)
 
@@ -38,20 +54,15 @@
  * The key compound data types 
  *****************************/
 
-/* Records the extent of each block's payload */
+/* Records the extent of each block's payload, as a node of a splay tree
+   ordered by address */
 typedef struct range_t {
     char *lo;              /* low payload address */
     char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
+    struct range_t *left;  /* payloads below this one */
+    struct range_t *right; /* payloads above this one */
 } range_t;
 
-/* Characterizes a single trace operation (allocator request) */
-typedef struct {
-    enum {ALLOC, FREE, REALLOC} type; /* type of request */
-    int index;                        /* index for free() to use later */
-    int size;                         /* byte size of alloc/realloc request */
-} traceop_t;
-
 /* Holds the information for one trace file*/
 typedef struct {
     unsigned sugg_heapsize;   /* suggested heap size (unused) */
@@ -61,6 +72,13 @@ typedef struct {
     traceop_t *ops;      /* array of requests */
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
+    void **batch;        /* room for the blocks of the longest batch... */
+    unsigned max_batch;  /* ... which has this many requests */
+    mm_region_t *region; /* region of the REGION_ALLOC requests, or NULL... */
+    int *region_ids;     /* ... and the ids of its blocks... */
+    unsigned region_len; /* ... of which there are this many */
+    void *map;           /* mapping of a binary trace file, or NULL... */
+    size_t map_len;      /* ... and its length */
 } trace_t;
 
 /* 
@@ -73,12 +91,72 @@ typedef struct {
     range_t *ranges;
 } speed_t;
 
+/* 
+ * Holds the params to eval_mt_speed, which replays a trace on nthreads
+ * threads at once.  Each thread has its own copy of the trace, which
+ * shares the requests but not the arrays of blocks.
+ */
+typedef struct {
+    trace_t *copies;  /* one copy of the trace per thread */
+    int nthreads;     /* number of threads */
+    int libc;         /* replay against libc malloc rather than mm.c */
+} mt_speed_t;
+
+/* 
+ * State of a trace that is streamed from its file (-s).  A prefetch
+ * thread reads the next window of requests while the current one is
+ * replayed, so only the two windows and the arrays of live blocks are
+ * ever in memory.
+ */
+typedef struct {
+    FILE *file;             /* trace file, at the next request to read */
+    char *path;             /* its name, for error messages */
+    int binary;             /* is it a binary trace? */
+    unsigned left;          /* requests the prefetcher has yet to read */
+    traceop_t *buf[2];      /* the two windows of requests */
+    unsigned len[2];        /* requests in each window, 0 past the end */
+    int full[2];            /* has the window been read but not replayed? */
+    pthread_mutex_t lock;   /* protects len and full */
+    pthread_cond_t cond;    /* signalled whenever full changes */
+    trace_t trace;          /* window being replayed, and the live blocks */
+    int total_size;         /* total payload of the live blocks */
+    int max_total_size;     /* peak of total_size */
+} stream_t;
+
+/* Summarizes how the throughput on some trace scales with threads */
+typedef struct {
+    double ops;           /* number of ops in the trace, per thread */
+    int valid;            /* was the trace processed correctly by mm.c? */
+    double libc_secs[2];  /* secs needed by libc malloc on 1 and N threads */
+    double mm_secs[2];    /* secs needed by mm.c on 1 and N threads */
+} scale_t;
+
+/* 
+ * Log-scale histogram of the latencies of one type of request, in
+ * cycles.  Bucket LAT_SUB*e + m holds the latencies whose highest set
+ * bit is bit e and whose next bits are m, so each power of two is split
+ * into LAT_SUB equal parts.
+ */
+typedef struct {
+    unsigned long long count;               /* number of requests */
+    unsigned long long max;                 /* longest latency */
+    unsigned long long bucket[LAT_BUCKETS]; /* requests per bucket */
+} hist_t;
+
+/* Latencies of the mm package on some trace, per type of request */
+typedef struct {
+    int valid;         /* was the trace processed correctly? */
+    hist_t hist[3];    /* indexed by ALLOC, FREE and REALLOC */
+} latency_t;
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* defined for both libc malloc and student malloc package (mm.c) */
     double ops;      /* number of ops (malloc/free/realloc) in the trace */
     int valid;       /* was the trace processed correctly by the allocator? */
     double secs;     /* number of secs needed to run the trace */
+    double ci;       /* half-width of the 95% confidence interval of secs,
+			or 0 if the timing method gives none */
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
@@ -93,6 +171,11 @@ int verbose = 0;        /* global flag for verbose output */
 static int errors = 0;  /* number of errs found when running student malloc */
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
 
+/* With -T, eval_mm_util samples the heap every timeline_ops requests
+   into the CSV file timeline */
+static int timeline_ops = 0;
+static FILE *timeline = NULL;
+
 /* Directory where default tracefiles are found */
 static char tracedir[MAXLINE] = TRACEDIR;
 
@@ -106,15 +189,22 @@ static char *default_tracefiles[] = {
  * Function prototypes 
  *********************/
 
-/* these functions manipulate range lists */
+/* these functions manipulate range trees */
 static int add_range(range_t **ranges, char *lo, int size, 
 		     int tracenum, int opnum);
 static void remove_range(range_t **ranges, char *lo);
 static void clear_ranges(range_t **ranges);
+static range_t *splay_ranges(range_t *t, char *lo);
 
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(char *tracedir, char *filename);
+static int read_header(FILE *tracefile, trace_t *trace);
+static int read_op(FILE *tracefile, traceop_t *op, char *path);
+static void map_trace(trace_t *trace, int fd, char *path);
+static void check_requests(trace_t *trace, char *path);
+static void write_trace(trace_t *trace, char *tracedir, char *filename);
 static void free_trace(trace_t *trace);
+static void trace_path(char *path, char *tracedir, char *filename, char *ext);
 
 /* Routines for evaluating the correctness and speed of libc malloc */
 static int eval_libc_valid(trace_t *trace, int tracenum);
@@ -125,9 +215,31 @@ static void eval_libc_speed(void *ptr);
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
 static void eval_mm_speed(void *ptr);
+static void replay_mm(trace_t *trace);
+static FILE *open_timeline(char *tracedir, char *filename);
+static void sample_timeline(unsigned op, int total_size);
+
+/* Routines for measuring the latency of every request of a trace */
+static void eval_mm_latency(trace_t *trace, latency_t *lat);
+static void add_latency(hist_t *hist, unsigned long long cycles);
+static unsigned long long latency_quantile(hist_t *hist, double q);
+
+/* Routines for replaying a trace on several threads at once */
+static void eval_mt_speed(void *ptr);
+static void *libc_thread(void *ptr);
+static void *mm_thread(void *ptr);
+static double mt_secs(trace_t *trace, int nthreads, int libc);
+
+/* Routines for streaming a trace from its file in windows */
+static void eval_mm_stream(char *tracedir, char *filename, stats_t *stats);
+static void *prefetch_thread(void *ptr);
+static void replay_window(void *ptr);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static char *percent(double ci, double secs, char *buf);
+static void printscaling(int n, int nthreads, scale_t *stats);
+static void printlatency(int n, latency_t *stats);
 static void usage(void);
 static void unix_error(char *msg);
 static void malloc_error(int tracenum, int opnum, char *msg);
@@ -146,11 +258,19 @@ int main(int argc, char **argv)
     range_t *ranges = NULL;    /* keeps track of block extents for one trace */
     stats_t *libc_stats = NULL;/* libc stats for each trace */
     stats_t *mm_stats = NULL;  /* mm (i.e. student) stats for each trace */
+    scale_t *scale_stats = NULL;/* scaling stats for each trace (-j) */
+    latency_t *lat_stats = NULL;/* latency stats for each trace (-p) */
     speed_t speed_params;      /* input parameters to the xx_speed routines */ 
 
     int team_check = 1;  /* If set, check team structure (reset by -a) */
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    int num_jobs = 0;    /* If set, replay on this many threads (-j) */
+    int run_latency = 0; /* If set, measure per-request latency (-p) */
+    int convert = 0;     /* If set, only convert traces to binary (-c) */
+    int stream = 0;      /* If set, only stream each trace once (-s) */
+    int defer = 0;       /* If set, defer coalescing in mm.c (-d) */
+    int ordered = 0;     /* If set, keep mm.c's free lists in address order (-o) */
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
@@ -159,7 +279,7 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "f:t:j:T:hvVgalpcsdo")) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -185,6 +305,33 @@ int main(int argc, char **argv)
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+        case 'c': /* Convert the traces to the binary format and exit */
+            convert = 1;
+            break;
+        case 'd': /* Run the mm package with deferred coalescing */
+            defer = 1;
+            break;
+        case 'o': /* Run the mm package with address-ordered free lists */
+            ordered = 1;
+            break;
+        case 's': /* Stream each trace from its file, replaying it once */
+            stream = 1;
+            break;
+        case 'p': /* Print percentiles of the latency of each request */
+            run_latency = 1;
+            break;
+        case 'j': /* Replay each trace on this many threads at once */
+            if ((num_jobs = atoi(optarg)) < 1) {
+		usage();
+		exit(1);
+	    }
+            break;
+        case 'T': /* Write a timeline of the heap of each trace */
+            if ((timeline_ops = atoi(optarg)) < 1) {
+		usage();
+		exit(1);
+	    }
+            break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -200,6 +347,11 @@ int main(int argc, char **argv)
         }
     }
 	
+    if (defer)
+	mm_set_deferred(1);
+    if (ordered)
+	mm_set_address_ordered(1);
+
     /* 
      * Check and print team info 
      */
@@ -236,6 +388,34 @@ int main(int argc, char **argv)
 	printf("Using default tracefiles in %s\n", tracedir);
     }
 
+    /*
+     * With -c, write a binary copy of every trace and do nothing else
+     */
+    if (convert) {
+	for (i=0; i < num_tracefiles; i++) {
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    write_trace(trace, tracedir, tracefiles[i]);
+	    free_trace(trace);
+	}
+	exit(0);
+    }
+
+    /*
+     * With -s, replay every trace once as it is read, rather than
+     * loading it first, and do nothing else
+     */
+    if (stream) {
+	mm_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
+	if (mm_stats == NULL)
+	    unix_error("mm_stats calloc in main failed");
+	mem_init();
+	for (i=0; i < num_tracefiles; i++)
+	    eval_mm_stream(tracedir, tracefiles[i], &mm_stats[i]);
+	printf("\nResults for mm malloc, streamed:\n");
+	printresults(num_tracefiles, mm_stats);
+	exit(0);
+    }
+
     /* Initialize the timing package */
     init_fsecs();
 
@@ -262,7 +442,8 @@ int main(int argc, char **argv)
 		speed_params.trace = trace;
 		if (verbose > 1)
 		    printf("and performance.\n");
-		libc_stats[i].secs = fsecs(eval_libc_speed, &speed_params);
+		libc_stats[i].secs = fsecs_ci(eval_libc_speed, &speed_params,
+					      1, &libc_stats[i].ci);
 	    }
 	    free_trace(trace);
 	}
@@ -298,12 +479,18 @@ int main(int argc, char **argv)
 	if (mm_stats[i].valid) {
 	    if (verbose > 1)
 		printf("efficiency, ");
+	    if (timeline_ops)
+		timeline = open_timeline(tracedir, tracefiles[i]);
 	    mm_stats[i].util = eval_mm_util(trace, i, &ranges);
+	    if (timeline != NULL && fclose(timeline) != 0)
+		unix_error("Could not write a timeline in main");
+	    timeline = NULL;
 	    speed_params.trace = trace;
 	    speed_params.ranges = ranges;
 	    if (verbose > 1)
 		printf("and performance.\n");
-	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+	    mm_stats[i].secs = fsecs_ci(eval_mm_speed, &speed_params, 1,
+					&mm_stats[i].ci);
 	}
 	free_trace(trace);
     }
@@ -315,6 +502,63 @@ int main(int argc, char **argv)
 	printf("\n");
     }
 
+    /*
+     * Optionally time every request of the traces the mm package got
+     * right, one by one
+     */
+    if (run_latency) {
+	lat_stats = (latency_t *)calloc(num_tracefiles, sizeof(latency_t));
+	if (lat_stats == NULL)
+	    unix_error("lat_stats calloc in main failed");
+
+	for (i=0; i < num_tracefiles; i++) {
+	    lat_stats[i].valid = mm_stats[i].valid;
+	    if (!lat_stats[i].valid)
+		continue;
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    if (verbose > 1)
+		printf("Timing each request.\n");
+	    eval_mm_latency(trace, &lat_stats[i]);
+	    free_trace(trace);
+	}
+
+	printf("Latency of mm malloc requests in cycles:\n");
+	printlatency(num_tracefiles, lat_stats);
+	printf("\n");
+    }
+
+    /*
+     * Optionally replay every trace the mm package got right on one and
+     * on num_jobs threads at once, against mm.c and against libc
+     */
+    if (num_jobs > 0) {
+	scale_stats = (scale_t *)calloc(num_tracefiles, sizeof(scale_t));
+	if (scale_stats == NULL)
+	    unix_error("scale_stats calloc in main failed");
+
+	mm_set_threaded(1);
+	for (i=0; i < num_tracefiles; i++) {
+	    scale_stats[i].valid = mm_stats[i].valid;
+	    if (!scale_stats[i].valid)
+		continue;
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    scale_stats[i].ops = trace->num_ops;
+	    if (verbose > 1)
+		printf("Replaying on 1 and %d threads.\n", num_jobs);
+	    scale_stats[i].libc_secs[0] = mt_secs(trace, 1, 1);
+	    scale_stats[i].libc_secs[1] = mt_secs(trace, num_jobs, 1);
+	    scale_stats[i].mm_secs[0] = mt_secs(trace, 1, 0);
+	    scale_stats[i].mm_secs[1] = mt_secs(trace, num_jobs, 0);
+	    free_trace(trace);
+	}
+	mm_set_threaded(0);
+
+	printf("Scaling of mm malloc and libc malloc on %d threads:\n",
+	       num_jobs);
+	printscaling(num_tracefiles, num_jobs, scale_stats);
+	printf("\n");
+    }
+
     /* 
      * Accumulate the aggregate statistics for the student's mm package 
      */
@@ -368,16 +612,18 @@ int main(int argc, char **argv)
 
 
 /*****************************************************************
- * The following routines manipulate the range list, which keeps 
+ * The following routines manipulate the range tree, which keeps 
  * track of the extent of every allocated block payload. We use the 
- * range list to detect any overlapping allocated blocks.
+ * range tree to detect any overlapping allocated blocks.  It is a
+ * splay tree ordered by address, so that checking and removing a
+ * payload take O(log n) amortized time.
  ****************************************************************/
 
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of 
  *     size bytes at addr lo. After checking the block for correctness,
- *     we create a range struct for this block and add it to the range list. 
+ *     we create a range struct for this block and add it to the range tree. 
  */
 static int add_range(range_t **ranges, char *lo, int size, 
 		     int tracenum, int opnum)
@@ -396,19 +642,33 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
-	(hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* The payload must lie within the extent of one arena of the heap */
+    if (!mem_is_heap(lo, hi)) {
 	sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
 		lo, hi, mem_heap_lo(), mem_heap_hi());
 	malloc_error(tracenum, opnum, msg);
         return 0;
     }
 
-    /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
+    /* 
+     * The payload must not overlap any other payloads.  The payloads in
+     * the tree do not overlap each other, so only the last one to start
+     * at or below lo and the first one to start above it can overlap.
+     */
+    if ((*ranges = splay_ranges(*ranges, lo)) != NULL) {
+	if ((*ranges)->lo <= lo) {
+	    p = *ranges;
+	    if (p->hi < lo)
+		for (p = p->right; p != NULL && p->left != NULL; p = p->left)
+		    ;
+	}
+	else {
+	    p = *ranges;
+	    if (p->lo > hi)
+		for (p = p->left; p != NULL && p->right != NULL; p = p->right)
+		    ;
+	}
+	if (p != NULL && lo <= p->hi && hi >= p->lo) {
 	    sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
 		    lo, hi, p->lo, p->hi);
 	    malloc_error(tracenum, opnum, msg);
@@ -418,13 +678,26 @@ static int add_range(range_t **ranges, char *lo, int size,
 
     /* 
      * Everything looks OK, so remember the extent of this block 
-     * by creating a range struct and adding it the range list.
+     * by creating a range struct and making it the root of the tree,
+     * split around it.
      */
     if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
 	unix_error("malloc error in add_range");
-    p->next = *ranges;
     p->lo = lo;
     p->hi = hi;
+    p->left = p->right = NULL;
+    if (*ranges != NULL) {
+	if ((*ranges)->lo < lo) {
+	    p->left = *ranges;
+	    p->right = (*ranges)->right;
+	    (*ranges)->right = NULL;
+	}
+	else {
+	    p->right = *ranges;
+	    p->left = (*ranges)->left;
+	    (*ranges)->left = NULL;
+	}
+    }
     *ranges = p;
     return 1;
 }
@@ -435,18 +708,17 @@ static int add_range(range_t **ranges, char *lo, int size,
 static void remove_range(range_t **ranges, char *lo)
 {
     range_t *p;
-    range_t **prevpp = ranges;
-    int size;
-
-    for (p = *ranges;  p != NULL; p = p->next) {
-        if (p->lo == lo) {
-	    *prevpp = p->next;
-            size = p->hi - p->lo + 1;
-            free(p);
-            break;
-        }
-        prevpp = &(p->next);
+
+    if ((p = *ranges = splay_ranges(*ranges, lo)) == NULL || p->lo != lo)
+	return;
+    if (p->left == NULL)
+	*ranges = p->right;
+    else {
+	/* Every payload on the left is below lo: the last becomes root */
+	*ranges = splay_ranges(p->left, lo);
+	(*ranges)->right = p->right;
     }
+    free(p);
 }
 
 /*
@@ -454,31 +726,94 @@ static void remove_range(range_t **ranges, char *lo)
  */
 static void clear_ranges(range_t **ranges)
 {
-    range_t *p;
-    range_t *pnext;
-
-    for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
-        free(p);
+    range_t *p = *ranges;
+    range_t *q;
+
+    /* Rotate left children up until the root has none, then drop it */
+    while (p != NULL) {
+	if ((q = p->left) != NULL) {
+	    p->left = q->right;
+	    q->right = p;
+	    p = q;
+	}
+	else {
+	    q = p->right;
+	    free(p);
+	    p = q;
+	}
     }
     *ranges = NULL;
 }
 
+/*
+ * splay_ranges - Top-down splay of the range tree t at address lo.
+ *     Returns the new root: the payload starting at lo if there is one,
+ *     and otherwise the last payload before it or the first one after.
+ */
+static range_t *splay_ranges(range_t *t, char *lo)
+{
+    range_t *l = NULL, *r = NULL;        /* trees built on the way down */
+    range_t **lmax = &l, **rmin = &r;    /* where their next nodes go */
+    range_t *y;
+
+    if (t == NULL)
+	return NULL;
+    for (;;) {
+	if (lo < t->lo) {
+	    if (t->left == NULL)
+		break;
+	    if (lo < t->left->lo) {           /* rotate right */
+		y = t->left;
+		t->left = y->right;
+		y->right = t;
+		t = y;
+		if (t->left == NULL)
+		    break;
+	    }
+	    *rmin = t;                        /* link right */
+	    rmin = &t->left;
+	    t = t->left;
+	}
+	else if (lo > t->lo) {
+	    if (t->right == NULL)
+		break;
+	    if (lo > t->right->lo) {          /* rotate left */
+		y = t->right;
+		t->right = y->left;
+		y->left = t;
+		t = y;
+		if (t->right == NULL)
+		    break;
+	    }
+	    *lmax = t;                        /* link left */
+	    lmax = &t->right;
+	    t = t->right;
+	}
+	else
+	    break;
+    }
+    *lmax = t->left;                          /* reassemble */
+    *rmin = t->right;
+    t->left = l;
+    t->right = r;
+    return t;
+}
+
 
 /**********************************************
  * The following routines manipulate tracefiles
  *********************************************/
 
 /*
- * read_trace - read a trace file and store it in memory
+ * read_trace - read a trace file and store it in memory.  A binary
+ *     trace, recognized by its magic number, is mapped rather than read.
  */
 static trace_t *read_trace(char *tracedir, char *filename)
 {
     FILE *tracefile;
     trace_t *trace;
-    char type[MAXLINE];
     char path[MAXLINE];
-    unsigned index, size;
+    unsigned index;
     unsigned max_index = 0;
     unsigned op_index;
 
@@ -488,6 +823,8 @@ static trace_t *read_trace(char *tracedir, char *filename)
     /* Allocate the trace record */
     if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
 	unix_error("malloc 1 failed in read_trance");
+    trace->map = NULL;
+    trace->map_len = 0;
 	
     /* Read the trace file header */
     strcpy(path, tracedir);
@@ -496,10 +833,11 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	sprintf(msg, "Could not open %s in read_trace", path);
 	unix_error(msg);
     }
-    fscanf(tracefile, "%u", &(trace->sugg_heapsize)); /* not used */
-    fscanf(tracefile, "%u", &(trace->num_ids));     
-    fscanf(tracefile, "%u", &(trace->num_ops));     
-    fscanf(tracefile, "%u", &(trace->weight));        /* not used */
+    if (read_header(tracefile, trace)) {
+	map_trace(trace, fileno(tracefile), path);
+	fclose(tracefile);
+	return trace;
+    }
     
     /* We'll store each request line in the trace in this array */
     if ((trace->ops = 
@@ -517,53 +855,291 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	unix_error("malloc 4 failed in read_trace");
     
     /* read every request line in the trace file */
-    index = 0;
     op_index = 0;
-    while (fscanf(tracefile, "%s", type) != EOF) {
-	switch(type[0]) {
-	case 'a':
-	    fscanf(tracefile, "%u %u", &index, &size);
-	    trace->ops[op_index].type = ALLOC;
-	    trace->ops[op_index].index = index;
-	    trace->ops[op_index].size = size;
-	    max_index = (index > max_index) ? index : max_index;
-	    break;
-	case 'r':
-	    fscanf(tracefile, "%u %u", &index, &size);
-	    trace->ops[op_index].type = REALLOC;
-	    trace->ops[op_index].index = index;
-	    trace->ops[op_index].size = size;
+    while (op_index < trace->num_ops &&
+	   read_op(tracefile, &trace->ops[op_index], path)) {
+	index = trace->ops[op_index].index;
+	if (trace->ops[op_index].type != BATCH)
 	    max_index = (index > max_index) ? index : max_index;
-	    break;
-	case 'f':
-	    fscanf(tracefile, "%ud", &index);
-	    trace->ops[op_index].type = FREE;
-	    trace->ops[op_index].index = index;
-	    break;
-	default:
-	    printf("Bogus type character (%c) in tracefile %s\n", 
-		   type[0], path);
-	    exit(1);
-	}
 	op_index++;
-	
     }
     fclose(tracefile);
     assert(max_index == trace->num_ids - 1);
     assert(trace->num_ops == op_index);
+    check_requests(trace, path);
     
     return trace;
 }
 
 /*
- * free_trace - Free the trace record and the three arrays it points
- *              to, all of which were allocated in read_trace().
+ * read_header - read the header of a trace file into trace.  Returns
+ *     1 for a binary trace and 0 for a text trace.
+ */
+static int read_header(FILE *tracefile, trace_t *trace)
+{
+    binhdr_t hdr;
+
+    if (fread(&hdr, sizeof(hdr), 1, tracefile) == 1 && hdr.magic == BIN_MAGIC) {
+	trace->sugg_heapsize = 0;
+	trace->num_ids = hdr.num_ids;
+	trace->num_ops = hdr.num_ops;
+	trace->weight = hdr.weight;
+	return 1;
+    }
+    rewind(tracefile);
+    fscanf(tracefile, "%u", &(trace->sugg_heapsize)); /* not used */
+    fscanf(tracefile, "%u", &(trace->num_ids));     
+    fscanf(tracefile, "%u", &(trace->num_ops));     
+    fscanf(tracefile, "%u", &(trace->weight));        /* not used */
+    return 0;
+}
+
+/*
+ * read_op - read the next request line of a text trace into op.
+ *     Returns 0 at the end of the file.
+ */
+static int read_op(FILE *tracefile, traceop_t *op, char *path)
+{
+    char type[MAXLINE];
+    unsigned index, size = 0;
+
+    if (fscanf(tracefile, "%s", type) == EOF)
+	return 0;
+    switch(type[0]) {
+    case 'a':
+	fscanf(tracefile, "%u %u", &index, &size);
+	op->type = ALLOC;
+	break;
+    case 'r':
+	fscanf(tracefile, "%u %u", &index, &size);
+	op->type = REALLOC;
+	break;
+    case 'f':
+	fscanf(tracefile, "%ud", &index);
+	op->type = FREE;
+	break;
+    case 'b':
+	fscanf(tracefile, "%u", &index);
+	op->type = BATCH;
+	break;
+    case 'g':
+	fscanf(tracefile, "%u %u", &index, &size);
+	op->type = REGION_ALLOC;
+	break;
+    case 'G':
+	index = 0;
+	op->type = REGION_FREE;
+	break;
+    default:
+	printf("Bogus type character (%c) in tracefile %s\n", 
+	       type[0], path);
+	exit(1);
+    }
+    op->index = index;
+    op->size = size;
+    return 1;
+}
+
+/*
+ * map_trace - map the requests of the binary trace file open on fd,
+ *     whose header is already in trace, and allocate the arrays of
+ *     blocks for them
+ */
+static void map_trace(trace_t *trace, int fd, char *path)
+{
+    struct stat st;
+
+    if (fstat(fd, &st) < 0)
+	unix_error("fstat failed in map_trace");
+    if ((size_t)st.st_size < sizeof(binhdr_t)) {
+	sprintf(msg, "Binary trace %s is truncated", path);
+	app_error(msg);
+    }
+    trace->map_len = st.st_size;
+    trace->map = mmap(NULL, trace->map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (trace->map == MAP_FAILED)
+	unix_error("mmap failed in map_trace");
+
+    if (trace->map_len - sizeof(binhdr_t) != 
+	(size_t)trace->num_ops * sizeof(traceop_t)) {
+	sprintf(msg, "Binary trace %s does not hold %u requests", 
+		path, trace->num_ops);
+	app_error(msg);
+    }
+    trace->ops = (traceop_t *)((binhdr_t *)trace->map + 1);
+
+    if ((trace->blocks = 
+	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
+	unix_error("malloc 3 failed in map_trace");
+    if ((trace->block_sizes = 
+	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
+	unix_error("malloc 4 failed in map_trace");
+    check_requests(trace, path);
+}
+
+/*
+ * check_requests - Check that every request of a trace has a known type,
+ *     an id below num_ids and a size that is not negative; a mapped
+ *     trace is not checked by anything else.  Check that every batch is
+ *     followed by its requests, all allocs of one size or all frees, and
+ *     that a block of the region is not allocated there again, freed or
+ *     reallocated until the region is freed.  Make room in trace->batch
+ *     for the blocks of the longest batch, and in trace->region_ids for
+ *     the ids of the region.
+ */
+static void check_requests(trace_t *trace, char *path)
+{
+    traceop_t *ops = trace->ops;
+    unsigned i, j, n;
+    char *in_region;
+    int *live;
+
+    for (i = 0; i < trace->num_ops; i++) {
+	switch (ops[i].type) {
+	case ALLOC:
+	case FREE:
+	case REALLOC:
+	case REGION_ALLOC:
+	    if ((unsigned)ops[i].index >= trace->num_ids) {
+		sprintf(msg, "Request %u of %s has id %d, but the trace has %u ids", 
+			i, path, ops[i].index, trace->num_ids);
+		app_error(msg);
+	    }
+	    break;
+	case BATCH:
+	case REGION_FREE:
+	    break;
+	default:
+	    sprintf(msg, "Request %u of %s has bogus type %d", 
+		    i, path, (int)ops[i].type);
+	    app_error(msg);
+	}
+	if (ops[i].size < 0) {
+	    sprintf(msg, "Request %u of %s has negative size %d", 
+		    i, path, ops[i].size);
+	    app_error(msg);
+	}
+    }
+
+    /* Replay the lifetime of the region: an id is in it from its region
+       alloc to the next region free, and only once at a time */
+    if ((in_region = (char *)calloc(trace->num_ids + 1, 1)) == NULL ||
+	(live = (int *)malloc((trace->num_ids + 1) * sizeof(int))) == NULL)
+	unix_error("malloc failed in check_requests");
+    n = 0;
+    for (i = 0; i < trace->num_ops; i++) {
+	switch (ops[i].type) {
+	case REGION_ALLOC:
+	    if (in_region[ops[i].index]) {
+		sprintf(msg, "Request %u of %s allocates id %d in the region twice", 
+			i, path, ops[i].index);
+		app_error(msg);
+	    }
+	    in_region[ops[i].index] = 1;
+	    live[n++] = ops[i].index;
+	    break;
+	case REGION_FREE:
+	    while (n > 0)
+		in_region[live[--n]] = 0;
+	    break;
+	case FREE:
+	case REALLOC:
+	    if (in_region[ops[i].index]) {
+		sprintf(msg, "Request %u of %s frees a block of the region", i, path);
+		app_error(msg);
+	    }
+	    break;
+	default:
+	    break;
+	}
+    }
+    free(in_region);
+    free(live);
+
+    trace->max_batch = 0;
+    for (i = 0; i < trace->num_ops; i++) {
+	if (ops[i].type != BATCH)
+	    continue;
+	n = ops[i].index;
+	if (n == 0 || n > trace->num_ops - i - 1) {
+	    sprintf(msg, "Batch at request %u of %s runs past the end", i, path);
+	    app_error(msg);
+	}
+	for (j = i + 1; j <= i + n; j++)
+	    if ((ops[j].type != ALLOC && ops[j].type != FREE) ||
+		ops[j].type != ops[i + 1].type || ops[j].size != ops[i + 1].size) {
+		sprintf(msg, "Batch at request %u of %s mixes requests", i, path);
+		app_error(msg);
+	    }
+	if (n > trace->max_batch)
+	    trace->max_batch = n;
+	i += n;
+    }
+    if ((trace->batch = 
+	 (void **)malloc((trace->max_batch + 1) * sizeof(void *))) == NULL ||
+	(trace->region_ids = 
+	 (int *)malloc((trace->num_ids + 1) * sizeof(int))) == NULL)
+	unix_error("malloc failed in check_requests");
+    trace->region = NULL;
+    trace->region_len = 0;
+}
+
+/*
+ * write_trace - write a trace in the binary format, to the file in
+ *     tracedir named like the text trace but with a .bin suffix
+ */
+static void write_trace(trace_t *trace, char *tracedir, char *filename)
+{
+    FILE *binfile;
+    binhdr_t hdr;
+    char path[MAXLINE];
+
+    trace_path(path, tracedir, filename, ".bin");
+    hdr.magic = BIN_MAGIC;
+    hdr.num_ids = trace->num_ids;
+    hdr.num_ops = trace->num_ops;
+    hdr.weight = trace->weight;
+    if ((binfile = fopen(path, "w")) == NULL) {
+	unix_error(path);
+    }
+    if (fwrite(&hdr, sizeof(hdr), 1, binfile) != 1 ||
+	fwrite(trace->ops, sizeof(traceop_t), trace->num_ops, binfile) 
+	!= trace->num_ops || fclose(binfile) != 0) {
+	unix_error(path);
+    }
+    printf("Wrote %s\n", path);
+}
+
+/*
+ * trace_path - The path of a file that goes with a trace: the trace file
+ *     with its extension replaced by ext
+ */
+static void trace_path(char *path, char *tracedir, char *filename, char *ext)
+{
+    char *dot;
+
+    strcpy(path, tracedir);
+    strcat(path, filename);
+    if ((dot = strrchr(path, '.')) != NULL && strchr(dot, '/') == NULL)
+	*dot = '\0';
+    strcat(path, ext);
+}
+
+/*
+ * free_trace - Free the trace record and the five arrays it points
+ *              to, all of which were allocated in read_trace().  The
+ *              requests of a binary trace are unmapped instead.
  */
 void free_trace(trace_t *trace)
 {
-    free(trace->ops);         /* free the three arrays... */
+    if (trace->map != NULL)   /* free the five arrays... */
+	munmap(trace->map, trace->map_len);
+    else
+	free(trace->ops);
     free(trace->blocks);      
     free(trace->block_sizes);
+    free(trace->batch);
+    free(trace->region_ids);
     free(trace);              /* and the trace record itself... */
 }
 
@@ -584,8 +1160,9 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
     char *newp;
     char *oldp;
     char *p;
+    traceop_t *batch;
     
-    /* Reset the heap and free any records in the range list */
+    /* Reset the heap and free any records in the range tree */
     mem_reset_brk();
     clear_ranges(ranges);
 
@@ -594,6 +1171,8 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	malloc_error(tracenum, 0, "mm_init failed.");
 	return 0;
     }
+    trace->region = NULL;
+    trace->region_len = 0;
 
     /* Interpret each operation in the trace in order */
     for (i = 0;  i < trace->num_ops;  i++) {
@@ -612,11 +1191,16 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    
 	    /* 
 	     * Test the range of the new block for correctness and add it 
-	     * to the range list if OK. The block must be  be aligned properly,
+	     * to the range tree if OK. The block must be  be aligned properly,
 	     * and must not overlap any currently allocated block. 
 	     */ 
 	    if (add_range(ranges, p, size, tracenum, i) == 0)
 		return 0;
+	    if (mm_usable_size(p) < size) {
+		malloc_error(tracenum, i, "mm_usable_size is less than "
+			     "was asked for.");
+		return 0;
+	    }
 	    
 	    /* ADDED: cgw
 	     * fill range with low byte of index.  This will be used later
@@ -639,12 +1223,17 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 		return 0;
 	    }
 	    
-	    /* Remove the old region from the range list */
+	    /* Remove the old region from the range tree */
 	    remove_range(ranges, oldp);
 	    
-	    /* Check new block for correctness and add it to range list */
+	    /* Check new block for correctness and add it to range tree */
 	    if (add_range(ranges, newp, size, tracenum, i) == 0)
 		return 0;
+	    if (mm_usable_size(newp) < size) {
+		malloc_error(tracenum, i, "mm_usable_size is less than "
+			     "was asked for.");
+		return 0;
+	    }
 	    
 	    /* ADDED: cgw
 	     * Make sure that the new block contains the data from the old 
@@ -654,7 +1243,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    oldsize = trace->block_sizes[index];
 	    if (size < oldsize) oldsize = size;
 	    for (j = 0; j < oldsize; j++) {
-	      if (newp[j] != (index & 0xFF)) {
+	      if ((unsigned char)newp[j] != (index & 0xFF)) {
 		malloc_error(tracenum, i, "mm_realloc did not preserve the "
 			     "data from old block");
 		return 0;
@@ -675,10 +1264,82 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    mm_free(p);
 	    break;
 
+	case BATCH: /* mm_malloc_batch or mm_free_batch */
+
+	    /* Allocate the blocks of the batch at once and check each as
+	       mm_malloc's, or remove each from the range tree and free
+	       them all at once */
+	    batch = &trace->ops[i + 1];
+	    if (batch[0].type == ALLOC) {
+		size = batch[0].size;
+		if (mm_malloc_batch(size, index, trace->batch) != (size_t)index) {
+		    malloc_error(tracenum, i, "mm_malloc_batch failed.");
+		    return 0;
+		}
+		for (j = 0; j < (unsigned)index; j++) {
+		    p = trace->batch[j];
+		    if (add_range(ranges, p, size, tracenum, i + 1 + j) == 0)
+			return 0;
+		    memset(p, batch[j].index & 0xFF, size);
+		    trace->blocks[batch[j].index] = p;
+		    trace->block_sizes[batch[j].index] = size;
+		}
+	    }
+	    else {
+		for (j = 0; j < (unsigned)index; j++) {
+		    p = trace->blocks[batch[j].index];
+		    remove_range(ranges, p);
+		    trace->batch[j] = p;
+		}
+		mm_free_batch(trace->batch, index);
+	    }
+	    i += index;
+	    break;
+
+	case REGION_ALLOC: /* mm_region_alloc */
+
+	    /* Check the block like mm_malloc's, and remember it is in
+	       the region */
+	    if ((trace->region == NULL &&
+		 (trace->region = mm_region_create()) == NULL) ||
+		(p = mm_region_alloc(trace->region, size)) == NULL) {
+		malloc_error(tracenum, i, "mm_region_alloc failed.");
+		return 0;
+	    }
+	    if (add_range(ranges, p, size, tracenum, i) == 0)
+		return 0;
+	    memset(p, index & 0xFF, size);
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    trace->region_ids[trace->region_len++] = index;
+	    break;
+
+	case REGION_FREE: /* mm_region_destroy */
+	    for (j = 0; j < trace->region_len; j++)
+		remove_range(ranges, trace->blocks[trace->region_ids[j]]);
+	    mm_region_destroy(trace->region);
+	    trace->region = NULL;
+	    trace->region_len = 0;
+	    break;
+
 	default:
 	    app_error("Nonexistent request type in eval_mm_valid");
         }
 
+#ifdef MM_DEBUG
+	/* A debug build checks the blocks every request changed */
+	if (mm_check(0) < 0) {
+	    malloc_error(tracenum, i, "mm_check found the heap inconsistent");
+	    return 0;
+	}
+#endif
+    }
+
+    /* The whole heap is checked once at the end */
+    if (mm_check(1) < 0) {
+	malloc_error(tracenum, trace->num_ops - 1,
+		     "mm_check found the heap inconsistent");
+	return 0;
     }
 
     /* As far as we know, this is a valid malloc package */
@@ -690,10 +1351,9 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   The idea is to remember the high water mark "hwm" of the heap for 
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the 
- *   size of the heap in bytes after running the student's malloc 
- *   package on the trace. Note that our implementation of mem_sbrk() 
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap. 
+ *   peak size of the heap in bytes while running the student's malloc 
+ *   package on the trace. mem_sbrk() lets the package shrink the heap
+ *   again, so the final heap size may be well below that peak.
  *   
  */
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
@@ -705,6 +1365,8 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
     int total_size = 0;
     char *p;
     char *newp, *oldp;
+    traceop_t *batch;
+    unsigned j, n;
 
     /* Remove the unused variable warnings */
     tracenum = tracenum;
@@ -714,6 +1376,8 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
     mem_reset_brk();
     if (mm_init() < 0)
 	app_error("mm_init failed in eval_mm_util");
+    trace->region = NULL;
+    trace->region_len = 0;
 
     for (i = 0;  i < trace->num_ops;  i++) {
         switch (trace->ops[i].type) {
@@ -773,13 +1437,103 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    
 	    break;
 
+	case BATCH: /* mm_malloc_batch or mm_free_batch */
+	    n = trace->ops[i].index;
+	    batch = &trace->ops[i + 1];
+	    if (batch[0].type == ALLOC) {
+		size = batch[0].size;
+		if (mm_malloc_batch(size, n, trace->batch) != n)
+		    app_error("mm_malloc_batch failed in eval_mm_util");
+		for (j = 0; j < n; j++) {
+		    trace->blocks[batch[j].index] = trace->batch[j];
+		    trace->block_sizes[batch[j].index] = size;
+		}
+		total_size += n * size;
+		max_total_size = (total_size > max_total_size) ?
+		    total_size : max_total_size;
+	    }
+	    else {
+		for (j = 0; j < n; j++) {
+		    trace->batch[j] = trace->blocks[batch[j].index];
+		    total_size -= trace->block_sizes[batch[j].index];
+		}
+		mm_free_batch(trace->batch, n);
+	    }
+	    i += n;
+	    break;
+
+	case REGION_ALLOC: /* mm_region_alloc */
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+	    if ((trace->region == NULL &&
+		 (trace->region = mm_region_create()) == NULL) ||
+		(p = mm_region_alloc(trace->region, size)) == NULL)
+		app_error("mm_region_alloc failed in eval_mm_util");
+	    trace->block_sizes[index] = size;
+	    trace->region_ids[trace->region_len++] = index;
+	    total_size += size;
+	    max_total_size = (total_size > max_total_size) ?
+		total_size : max_total_size;
+	    break;
+
+	case REGION_FREE: /* mm_region_destroy */
+	    for (j = 0; j < trace->region_len; j++)
+		total_size -= trace->block_sizes[trace->region_ids[j]];
+	    mm_region_destroy(trace->region);
+	    trace->region = NULL;
+	    trace->region_len = 0;
+	    break;
+
 	default:
 	    app_error("Nonexistent request type in eval_mm_util");
 
         }
+	if (timeline != NULL && 
+	    ((i + 1) % timeline_ops == 0 || i + 1 == trace->num_ops))
+	    sample_timeline(i + 1, total_size);
+    }
+
+    return ((double)max_total_size / (double)mem_heap_peak());
+}
+
+/*
+ * open_timeline - Open the timeline of a trace, <trace>.csv next to the
+ *     trace file, and write its column names
+ */
+static FILE *open_timeline(char *tracedir, char *filename)
+{
+    FILE *f;
+    char path[MAXLINE];
+
+    trace_path(path, tracedir, filename, ".csv");
+    if ((f = fopen(path, "w")) == NULL) {
+	unix_error(path);
     }
+    fprintf(f, "op,live_bytes,heap_size,in_use,free_bytes,free_blocks,"
+	    "largest_free,util,frag\n");
+    if (verbose > 1)
+	printf("timeline in %s, ", path);
+    return f;
+}
 
-    return ((double)max_total_size / (double)mem_heapsize());
+/*
+ * sample_timeline - Write a line of the timeline after op requests, with
+ *     total_size bytes of payload live.  util is the payload over the
+ *     heap size; frag, the fragmentation index of the free memory, is
+ *     1 - largest_free / free_bytes: 0 when all free bytes are in one
+ *     block, and close to 1 when they are scattered in small ones.
+ */
+static void sample_timeline(unsigned op, int total_size)
+{
+    mm_stats_t st;
+
+    mm_stats(&st);
+    fprintf(timeline, "%u,%d,%lu,%lu,%lu,%lu,%lu,%.4f,%.4f\n", op, total_size,
+	    (unsigned long)st.heap_size, (unsigned long)st.in_use,
+	    (unsigned long)st.free_bytes, (unsigned long)st.free_blocks,
+	    (unsigned long)st.largest_free,
+	    st.heap_size ? (double)total_size / st.heap_size : 0.0,
+	    st.free_bytes ? 1.0 - (double)st.largest_free / st.free_bytes : 0.0);
 }
 
 
@@ -789,8 +1543,6 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
  */
 static void eval_mm_speed(void *ptr)
 {
-    unsigned i, index, size, newsize;
-    char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
 
     /* Reset the heap and initialize the mm package */
@@ -798,7 +1550,20 @@ static void eval_mm_speed(void *ptr)
     if (mm_init() < 0) 
 	app_error("mm_init failed in eval_mm_speed");
 
+    replay_mm(trace);
+}
+
+/*
+ * replay_mm - Interpret each request of a trace with the mm package
+ */
+static void replay_mm(trace_t *trace)
+{
+    unsigned i, j, index, size, newsize;
+    char *p, *newp, *oldp, *block;
+    traceop_t *batch;
+
     /* Interpret each trace request */
+    trace->region = NULL;
     for (i = 0;  i < trace->num_ops;  i++)
         switch (trace->ops[i].type) {
 
@@ -825,11 +1590,487 @@ static void eval_mm_speed(void *ptr)
             mm_free(block);
             break;
 
+	case BATCH: /* mm_malloc_batch or mm_free_batch */
+	    index = trace->ops[i].index;
+	    batch = &trace->ops[i + 1];
+	    if (batch[0].type == ALLOC) {
+		if (mm_malloc_batch(batch[0].size, index, trace->batch) != index)
+		    app_error("mm_malloc_batch error in eval_mm_speed");
+		for (j = 0; j < index; j++)
+		    trace->blocks[batch[j].index] = trace->batch[j];
+	    }
+	    else {
+		for (j = 0; j < index; j++)
+		    trace->batch[j] = trace->blocks[batch[j].index];
+		mm_free_batch(trace->batch, index);
+	    }
+	    i += index;
+	    break;
+
+	case REGION_ALLOC: /* mm_region_alloc */
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+	    if ((trace->region == NULL &&
+		 (trace->region = mm_region_create()) == NULL) ||
+		(p = mm_region_alloc(trace->region, size)) == NULL)
+		app_error("mm_region_alloc error in eval_mm_speed");
+	    trace->blocks[index] = p;
+	    break;
+
+	case REGION_FREE: /* mm_region_destroy */
+	    mm_region_destroy(trace->region);
+	    trace->region = NULL;
+	    break;
+
 	default:
 	    app_error("Nonexistent request type in eval_mm_valid");
         }
 }
 
+/*
+ * eval_mm_latency - Replay a trace with the mm package, timing each
+ *    request on its own with the cycle counter, and add the latencies
+ *    to the histograms of lat.  The cost of reading the counter is
+ *    taken off every latency.
+ */
+static void eval_mm_latency(trace_t *trace, latency_t *lat)
+{
+    unsigned i, j, index;
+    unsigned long long start, cycles, ovhd;
+    char *p;
+    traceop_t *batch;
+
+    /* The least cost of reading the counter twice in a row */
+    ovhd = ~0ULL;
+    for (i = 0; i < 100; i++) {
+	start = read_counter();
+	cycles = read_counter() - start;
+	if (cycles < ovhd)
+	    ovhd = cycles;
+    }
+
+    /* Reset the heap and initialize the mm package */
+    mem_reset_brk();
+    if (mm_init() < 0) 
+	app_error("mm_init failed in eval_mm_latency");
+    trace->region = NULL;
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* mm_malloc */
+	    start = read_counter();
+	    p = mm_malloc(trace->ops[i].size);
+	    cycles = read_counter() - start;
+	    if (p == NULL)
+		app_error("mm_malloc error in eval_mm_latency");
+	    trace->blocks[index] = p;
+	    break;
+
+	case REALLOC: /* mm_realloc */
+	    start = read_counter();
+	    p = mm_realloc(trace->blocks[index], trace->ops[i].size);
+	    cycles = read_counter() - start;
+	    if (p == NULL)
+		app_error("mm_realloc error in eval_mm_latency");
+	    trace->blocks[index] = p;
+	    break;
+
+        case FREE: /* mm_free */
+	    start = read_counter();
+	    mm_free(trace->blocks[index]);
+	    cycles = read_counter() - start;
+	    break;
+
+	case BATCH: /* mm_malloc_batch or mm_free_batch */
+
+	    /* Each request of the batch counts with its share of the call */
+	    batch = &trace->ops[i + 1];
+	    if (batch[0].type == ALLOC) {
+		start = read_counter();
+		if (mm_malloc_batch(batch[0].size, index, trace->batch) != index)
+		    app_error("mm_malloc_batch error in eval_mm_latency");
+		cycles = read_counter() - start;
+		for (j = 0; j < index; j++)
+		    trace->blocks[batch[j].index] = trace->batch[j];
+	    }
+	    else {
+		for (j = 0; j < index; j++)
+		    trace->batch[j] = trace->blocks[batch[j].index];
+		start = read_counter();
+		mm_free_batch(trace->batch, index);
+		cycles = read_counter() - start;
+	    }
+	    cycles = cycles > ovhd ? (cycles - ovhd) / index : 0;
+	    for (j = 0; j < index; j++)
+		add_latency(&lat->hist[batch[0].type], cycles);
+	    i += index;
+	    continue;
+
+	case REGION_ALLOC: /* mm_region_alloc, counted as a malloc */
+	    start = read_counter();
+	    if (trace->region == NULL)
+		trace->region = mm_region_create();
+	    p = trace->region == NULL ? NULL :
+		mm_region_alloc(trace->region, trace->ops[i].size);
+	    cycles = read_counter() - start;
+	    if (p == NULL)
+		app_error("mm_region_alloc error in eval_mm_latency");
+	    trace->blocks[index] = p;
+	    add_latency(&lat->hist[ALLOC], cycles > ovhd ? cycles - ovhd : 0);
+	    continue;
+
+	case REGION_FREE: /* mm_region_destroy, counted as one free */
+	    start = read_counter();
+	    mm_region_destroy(trace->region);
+	    cycles = read_counter() - start;
+	    trace->region = NULL;
+	    add_latency(&lat->hist[FREE], cycles > ovhd ? cycles - ovhd : 0);
+	    continue;
+
+	default:
+	    app_error("Nonexistent request type in eval_mm_latency");
+	}
+	add_latency(&lat->hist[trace->ops[i].type],
+		    cycles > ovhd ? cycles - ovhd : 0);
+    }
+}
+
+/*
+ * add_latency - Count a request that took this many cycles
+ */
+static void add_latency(hist_t *hist, unsigned long long cycles)
+{
+    int e, b;
+
+    if (cycles < LAT_SUB)
+	b = (int)cycles;
+    else {
+	for (e = 63; !(cycles >> e); e--)
+	    ;
+	b = LAT_SUB * e + (int)((cycles >> (e - LAT_SUB_BITS)) & (LAT_SUB - 1));
+    }
+    hist->bucket[b]++;
+    hist->count++;
+    if (cycles > hist->max)
+	hist->max = cycles;
+}
+
+/*
+ * latency_quantile - Return a latency that at least a fraction q of the
+ *    requests did not exceed: the upper end of the bucket where that
+ *    fraction is reached, and never more than the longest one
+ */
+static unsigned long long latency_quantile(hist_t *hist, double q)
+{
+    unsigned long long seen = 0, upper;
+    int b, e;
+
+    for (b = 0; b < LAT_BUCKETS - 1; b++) {
+	seen += hist->bucket[b];
+	if (seen >= q * hist->count)
+	    break;
+    }
+    if (b < LAT_SUB)
+	upper = b;
+    else {
+	e = b / LAT_SUB;
+	upper = ((unsigned long long)(LAT_SUB + b % LAT_SUB + 1)
+		 << (e - LAT_SUB_BITS)) - 1;
+    }
+    return upper < hist->max ? upper : hist->max;
+}
+
+/*
+ * eval_mt_speed - This is the function that is used by fsecs() to
+ *    measure the running time of several threads replaying a trace at
+ *    once.  The time includes starting and joining the threads.
+ */
+static void eval_mt_speed(void *ptr)
+{
+    mt_speed_t *mt = (mt_speed_t *)ptr;
+    pthread_t tid[mt->nthreads];
+    int i;
+
+    if (!mt->libc) {
+	mem_reset_brk();
+	if (mm_init() < 0)
+	    app_error("mm_init failed in eval_mt_speed");
+    }
+    for (i = 0; i < mt->nthreads; i++)
+	if (pthread_create(&tid[i], NULL, mt->libc ? libc_thread : mm_thread,
+			   &mt->copies[i]) != 0)
+	    app_error("pthread_create failed in eval_mt_speed");
+    for (i = 0; i < mt->nthreads; i++)
+	pthread_join(tid[i], NULL);
+}
+
+/*
+ * libc_thread - Replay one copy of a trace against libc malloc
+ */
+static void *libc_thread(void *ptr)
+{
+    speed_t speed;
+
+    speed.trace = (trace_t *)ptr;
+    eval_libc_speed(&speed);
+    return NULL;
+}
+
+/*
+ * mm_thread - Replay one copy of a trace against the mm package
+ */
+static void *mm_thread(void *ptr)
+{
+    replay_mm((trace_t *)ptr);
+    return NULL;
+}
+
+/*
+ * mt_secs - Return the running time of nthreads threads, each replaying
+ *    its own copy of a trace at the same time, against libc malloc if
+ *    libc is set and against the mm package (which must be in
+ *    multithreaded mode) otherwise
+ */
+static double mt_secs(trace_t *trace, int nthreads, int libc)
+{
+    mt_speed_t mt;
+    double secs;
+    int i;
+
+    if ((mt.copies = (trace_t *)calloc(nthreads, sizeof(trace_t))) == NULL)
+	unix_error("malloc failed in mt_secs");
+    for (i = 0; i < nthreads; i++) {
+	mt.copies[i] = *trace;
+	mt.copies[i].blocks = (char **)calloc(trace->num_ids, sizeof(char *));
+	mt.copies[i].block_sizes = (size_t *)calloc(trace->num_ids,
+						    sizeof(size_t));
+	mt.copies[i].batch = (void **)calloc(trace->max_batch + 1,
+					     sizeof(void *));
+	mt.copies[i].region_ids = (int *)calloc(trace->num_ids + 1, sizeof(int));
+	if (mt.copies[i].blocks == NULL || mt.copies[i].block_sizes == NULL ||
+	    mt.copies[i].batch == NULL || mt.copies[i].region_ids == NULL)
+	    unix_error("malloc failed in mt_secs");
+    }
+    mt.nthreads = nthreads;
+    mt.libc = libc;
+
+    secs = fsecs_ci(eval_mt_speed, &mt, 0, NULL);
+
+    for (i = 0; i < nthreads; i++) {
+	free(mt.copies[i].blocks);
+	free(mt.copies[i].block_sizes);
+	free(mt.copies[i].batch);
+	free(mt.copies[i].region_ids);
+    }
+    free(mt.copies);
+    return secs;
+}
+
+/*
+ * eval_mm_stream - Replay a trace with the mm package once, while it
+ *    is read from its file one window of STREAM_OPS requests at a time,
+ *    and record its utilization and the time spent in the mm package.
+ *    This needs memory for the ids of the trace only, however long it
+ *    is; cap2rep reuses the ids of freed blocks, so there are as many
+ *    as blocks are live at once.
+ */
+static void eval_mm_stream(char *tracedir, char *filename, stats_t *stats)
+{
+    stream_t s;
+    pthread_t tid;
+    char path[MAXLINE];
+    int w;
+
+    if (verbose > 1)
+	printf("Streaming tracefile: %s\n", filename);
+
+    /* Open the trace and make room for its live blocks */
+    strcpy(path, tracedir);
+    strcat(path, filename);
+    if ((s.file = fopen(path, "r")) == NULL) {
+	sprintf(msg, "Could not open %s in eval_mm_stream", path);
+	unix_error(msg);
+    }
+    s.path = path;
+    s.binary = read_header(s.file, &s.trace);
+    s.left = s.trace.num_ops;
+    stats->ops = s.trace.num_ops;
+    s.trace.blocks = (char **)calloc(s.trace.num_ids, sizeof(char *));
+    s.trace.block_sizes = (size_t *)calloc(s.trace.num_ids, sizeof(size_t));
+    s.trace.region_ids = (int *)calloc(s.trace.num_ids + 1, sizeof(int));
+    if (s.trace.blocks == NULL || s.trace.block_sizes == NULL ||
+	s.trace.region_ids == NULL)
+	unix_error("calloc failed in eval_mm_stream");
+    s.trace.region = NULL;
+    s.trace.region_len = 0;
+    for (w = 0; w < 2; w++) {
+	s.buf[w] = (traceop_t *)malloc(STREAM_OPS * sizeof(traceop_t));
+	if (s.buf[w] == NULL)
+	    unix_error("malloc failed in eval_mm_stream");
+	s.full[w] = 0;
+    }
+    pthread_mutex_init(&s.lock, NULL);
+    pthread_cond_init(&s.cond, NULL);
+    s.total_size = 0;
+    s.max_total_size = 0;
+
+    /* Reset the heap and initialize the mm package */
+    mem_reset_brk();
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_mm_stream");
+
+    /* Replay the windows in turn, as the prefetcher fills them */
+    if (pthread_create(&tid, NULL, prefetch_thread, &s) != 0)
+	unix_error("pthread_create failed in eval_mm_stream");
+    stats->secs = 0;
+    for (w = 0; ; w ^= 1) {
+	pthread_mutex_lock(&s.lock);
+	while (!s.full[w])
+	    pthread_cond_wait(&s.cond, &s.lock);
+	s.trace.num_ops = s.len[w];
+	pthread_mutex_unlock(&s.lock);
+	if (s.trace.num_ops == 0)
+	    break;
+
+	s.trace.ops = s.buf[w];
+	stats->secs += ftimer_gettod(replay_window, &s, 1);
+
+	pthread_mutex_lock(&s.lock);
+	s.full[w] = 0;
+	pthread_cond_signal(&s.cond);
+	pthread_mutex_unlock(&s.lock);
+    }
+    pthread_join(tid, NULL);
+
+    stats->valid = 1;
+    stats->util = (double)s.max_total_size / (double)mem_heap_peak();
+
+    fclose(s.file);
+    free(s.buf[0]);
+    free(s.buf[1]);
+    free(s.trace.blocks);
+    free(s.trace.block_sizes);
+    free(s.trace.region_ids);
+    pthread_mutex_destroy(&s.lock);
+    pthread_cond_destroy(&s.cond);
+}
+
+/*
+ * prefetch_thread - Fill the two windows of a stream in turn, each as
+ *    soon as it has been replayed.  A window of length 0 marks the end.
+ */
+static void *prefetch_thread(void *ptr)
+{
+    stream_t *s = (stream_t *)ptr;
+    unsigned n, len;
+    int w;
+
+    for (w = 0; ; w ^= 1) {
+	pthread_mutex_lock(&s->lock);
+	while (s->full[w])
+	    pthread_cond_wait(&s->cond, &s->lock);
+	pthread_mutex_unlock(&s->lock);
+
+	n = (s->left < STREAM_OPS) ? s->left : STREAM_OPS;
+	if (s->binary)
+	    len = fread(s->buf[w], sizeof(traceop_t), n, s->file);
+	else
+	    for (len = 0; len < n && read_op(s->file, &s->buf[w][len], s->path);
+		 len++)
+		;
+	if (len < n) {
+	    sprintf(msg, "Trace %s ends before its last request", s->path);
+	    app_error(msg);
+	}
+	s->left -= n;
+
+	pthread_mutex_lock(&s->lock);
+	s->len[w] = n;
+	s->full[w] = 1;
+	pthread_cond_signal(&s->cond);
+	pthread_mutex_unlock(&s->lock);
+	if (n == 0)
+	    return NULL;
+    }
+}
+
+/*
+ * replay_window - Interpret the window of requests of a stream with
+ *    the mm package, keeping track of the total payload as eval_mm_util
+ *    does.  A batch may straddle two windows, so its requests are
+ *    replayed one at a time.  A region lives on from one window to the
+ *    next.  This is the function that is timed by ftimer.
+ */
+static void replay_window(void *ptr)
+{
+    stream_t *s = (stream_t *)ptr;
+    trace_t *trace = &s->trace;
+    unsigned i, j, index, size;
+    char *p;
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	if (trace->ops[i].type == BATCH)
+	    continue;
+	if (index >= trace->num_ids)
+	    app_error("Request index out of range in replay_window");
+	size = trace->ops[i].size;
+
+	switch (trace->ops[i].type) {
+
+	case ALLOC: /* mm_malloc */
+	    if ((p = mm_malloc(size)) == NULL)
+		app_error("mm_malloc failed in replay_window");
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    s->total_size += size;
+	    break;
+
+	case REALLOC: /* mm_realloc */
+	    if ((p = mm_realloc(trace->blocks[index], size)) == NULL)
+		app_error("mm_realloc failed in replay_window");
+	    s->total_size += size - trace->block_sizes[index];
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    break;
+
+	case FREE: /* mm_free */
+	    mm_free(trace->blocks[index]);
+	    s->total_size -= trace->block_sizes[index];
+	    trace->block_sizes[index] = 0;
+	    break;
+
+	case REGION_ALLOC: /* mm_region_alloc */
+	    if ((trace->region == NULL &&
+		 (trace->region = mm_region_create()) == NULL) ||
+		(p = mm_region_alloc(trace->region, size)) == NULL)
+		app_error("mm_region_alloc failed in replay_window");
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    trace->region_ids[trace->region_len++] = index;
+	    s->total_size += size;
+	    break;
+
+	case REGION_FREE: /* mm_region_destroy */
+	    for (j = 0; j < trace->region_len; j++) {
+		s->total_size -= trace->block_sizes[trace->region_ids[j]];
+		trace->block_sizes[trace->region_ids[j]] = 0;
+	    }
+	    mm_region_destroy(trace->region);
+	    trace->region = NULL;
+	    trace->region_len = 0;
+	    break;
+
+	default:
+	    app_error("Nonexistent request type in replay_window");
+	}
+	if (s->total_size > s->max_total_size)
+	    s->max_total_size = s->total_size;
+    }
+}
+
 /*
  * eval_libc_valid - We run this function to make sure that the
  *    libc malloc can run to completion on the set of traces.
@@ -838,9 +2079,10 @@ static void eval_mm_speed(void *ptr)
  */
 static int eval_libc_valid(trace_t *trace, int tracenum)
 {
-    unsigned i, newsize;
+    unsigned i, j, newsize;
     char *p, *newp, *oldp;
 
+    trace->region_len = 0;
     for (i = 0;  i < trace->num_ops;  i++) {
         switch (trace->ops[i].type) {
 
@@ -866,6 +2108,24 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
 	    free(trace->blocks[trace->ops[i].index]);
 	    break;
 
+	case BATCH: /* libc has no batches, so their requests come one by one */
+	    break;
+
+	case REGION_ALLOC: /* libc has no regions: malloc... */
+	    if ((p = malloc(trace->ops[i].size)) == NULL) {
+		malloc_error(tracenum, i, "libc malloc failed");
+		unix_error("System message");
+	    }
+	    trace->blocks[trace->ops[i].index] = p;
+	    trace->region_ids[trace->region_len++] = trace->ops[i].index;
+	    break;
+
+	case REGION_FREE: /* ... and a free for every block */
+	    for (j = 0; j < trace->region_len; j++)
+		free(trace->blocks[trace->region_ids[j]]);
+	    trace->region_len = 0;
+	    break;
+
 	default:
 	    app_error("invalid operation type  in eval_libc_valid");
 	}
@@ -881,11 +2141,12 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
  */
 static void eval_libc_speed(void *ptr)
 {
-    unsigned i;
+    unsigned i, j;
     int index, size, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
 
+    trace->region_len = 0;
     for (i = 0;  i < trace->num_ops;  i++) {
         switch (trace->ops[i].type) {
         case ALLOC: /* malloc */
@@ -911,6 +2172,23 @@ static void eval_libc_speed(void *ptr)
 	    block = trace->blocks[index];
 	    free(block);
 	    break;
+
+	case BATCH: /* libc has no batches, so their requests come one by one */
+	    break;
+
+	case REGION_ALLOC: /* libc has no regions: malloc... */
+	    index = trace->ops[i].index;
+	    if ((p = malloc(trace->ops[i].size)) == NULL)
+		unix_error("malloc failed in eval_libc_speed");
+	    trace->blocks[index] = p;
+	    trace->region_ids[trace->region_len++] = index;
+	    break;
+
+	case REGION_FREE: /* ... and a free for every block */
+	    for (j = 0; j < trace->region_len; j++)
+		free(trace->blocks[trace->region_ids[j]]);
+	    trace->region_len = 0;
+	    break;
 	}
     }
 }
@@ -920,6 +2198,19 @@ static void eval_libc_speed(void *ptr)
  ************************************/
 
 
+/*
+ * percent - format the interval ci of secs as a percentage of secs into
+ *     buf, or as "-" if there is none (ci is 0), and return buf
+ */
+static char *percent(double ci, double secs, char *buf)
+{
+    if (ci > 0)
+	sprintf(buf, "%.1f", 100.0*ci/secs);
+    else
+	strcpy(buf, "-");
+    return buf;
+}
+
 /*
  * printresults - prints a performance summary for some malloc package
  */
@@ -927,58 +2218,154 @@ static void printresults(int n, stats_t *stats)
 {
     int i;
     double secs = 0;
+    double var = 0;
     double ops = 0;
     double util = 0;
+    char pct[16];
 
-    /* Print the individual results for each trace */
+    /* Print the individual results for each trace.  The +-% column is
+     * the 95% confidence interval of secs, relative to secs, or "-" if
+     * the timing gives none, as for a single streamed replay */
     /* All the space before the last number on each line is added by 
      * Zheng Cai, for better formatting */
-    printf("%5s%7s %5s%8s%10s %6s\n", 
-	   "trace", " valid", "util", "ops", "secs", "Kops");
+    printf("%5s%7s %5s%8s%10s%6s %6s\n", 
+	   "trace", " valid", "util", "ops", "secs", "+-%", "Kops");
     for (i=0; i < n; i++) {
 	if (stats[i].valid) {
-	    printf("%2d%10s%5.0f%%%8.0f%10.6f %6.0f\n", 
+	    printf("%2d%10s%5.0f%%%8.0f%10.6f%6s %6.0f\n", 
 		   i,
 		   "yes",
 		   stats[i].util*100.0,
 		   stats[i].ops,
 		   stats[i].secs,
+		   percent(stats[i].ci, stats[i].secs, pct),
 		   (stats[i].ops/1e3)/stats[i].secs);
 	    secs += stats[i].secs;
+	    var += stats[i].ci*stats[i].ci;
 	    ops += stats[i].ops;
 	    util += stats[i].util;
 	}
 	else {
-	    printf("%2d%10s%6s%8s%10s %6s\n", 
+	    printf("%2d%10s%6s%8s%10s%6s %6s\n", 
 		   i,
 		   "no",
 		   "-",
 		   "-",
 		   "-",
+		   "-",
 		   "-");
 	}
     }
 
-    /* Print the aggregate results for the set of traces */
+    /* Print the aggregate results for the set of traces.  The runs of
+     * different traces are independent, so their intervals add up like
+     * standard deviations */
     if (errors == 0) {
-	printf("%12s%5.0f%%%8.0f%10.6f %6.0f\n", 
+	printf("%12s%5.0f%%%8.0f%10.6f%6s %6.0f\n", 
 	       "Total       ",
 	       (util/n)*100.0,
 	       ops, 
 	       secs,
+	       percent(sqrt(var), secs, pct),
 	       (ops/1e3)/secs);
     }
     else {
-	printf("%12s%6s%8s%10s %6s\n", 
+	printf("%12s%6s%8s%10s%6s %6s\n", 
 	       "Total       ",
 	       "-", 
 	       "-", 
 	       "-", 
+	       "-", 
 	       "-");
     }
 
 }
 
+/*
+ * printscaling - prints the throughput of libc malloc and of the mm
+ *    package on one and on nthreads threads, in Kops over all threads,
+ *    the speedup this is, and the Kops per thread of the mm package
+ */
+static void printscaling(int n, int nthreads, scale_t *stats)
+{
+    int i;
+    double ops = 0;
+    double libc_secs[2] = {0, 0};
+    double mm_secs[2] = {0, 0};
+
+    printf("%5s%9s%9s%7s%9s%9s%7s%8s\n",
+	   "trace", "libc 1", "libc N", "scale", "mm 1", "mm N", "scale",
+	   "mm/thr");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid) {
+	    printf("%2d%12.0f%9.0f%7.2f%9.0f%9.0f%7.2f%8.0f\n",
+		   i,
+		   (stats[i].ops/1e3)/stats[i].libc_secs[0],
+		   (nthreads*stats[i].ops/1e3)/stats[i].libc_secs[1],
+		   nthreads*stats[i].libc_secs[0]/stats[i].libc_secs[1],
+		   (stats[i].ops/1e3)/stats[i].mm_secs[0],
+		   (nthreads*stats[i].ops/1e3)/stats[i].mm_secs[1],
+		   nthreads*stats[i].mm_secs[0]/stats[i].mm_secs[1],
+		   (stats[i].ops/1e3)/stats[i].mm_secs[1]);
+	    ops += stats[i].ops;
+	    libc_secs[0] += stats[i].libc_secs[0];
+	    libc_secs[1] += stats[i].libc_secs[1];
+	    mm_secs[0] += stats[i].mm_secs[0];
+	    mm_secs[1] += stats[i].mm_secs[1];
+	}
+	else {
+	    printf("%2d%12s%9s%7s%9s%9s%7s%8s\n",
+		   i, "-", "-", "-", "-", "-", "-", "-");
+	}
+    }
+
+    /* Print the aggregate results for the set of traces */
+    if (ops > 0) {
+	printf("%5s%9.0f%9.0f%7.2f%9.0f%9.0f%7.2f%8.0f\n",
+	       "Total",
+	       (ops/1e3)/libc_secs[0],
+	       (nthreads*ops/1e3)/libc_secs[1],
+	       nthreads*libc_secs[0]/libc_secs[1],
+	       (ops/1e3)/mm_secs[0],
+	       (nthreads*ops/1e3)/mm_secs[1],
+	       nthreads*mm_secs[0]/mm_secs[1],
+	       (ops/1e3)/mm_secs[1]);
+    }
+}
+
+/*
+ * printlatency - prints the median, tail percentiles and the longest
+ *    latency of each type of request of the mm package on each trace
+ */
+static void printlatency(int n, latency_t *stats)
+{
+    static char *names[3] = {"malloc", "free", "realloc"};
+    hist_t *hist;
+    int i, t;
+
+    printf("%5s %-8s%8s%8s%8s%8s%10s\n",
+	   "trace", "request", "ops", "p50", "p99", "p99.9", "max");
+    for (i=0; i < n; i++) {
+	if (!stats[i].valid) {
+	    printf("%2d%4s%-8s%8s%8s%8s%8s%10s\n",
+		   i, "", "-", "-", "-", "-", "-", "-");
+	    continue;
+	}
+	for (t = 0; t < 3; t++) {
+	    hist = &stats[i].hist[t];
+	    if (hist->count == 0)
+		continue;
+	    printf("%2d%4s%-8s%8llu%8llu%8llu%8llu%10llu\n",
+		   i, "", names[t],
+		   hist->count,
+		   latency_quantile(hist, 0.5),
+		   latency_quantile(hist, 0.99),
+		   latency_quantile(hist, 0.999),
+		   hist->max);
+	}
+    }
+}
+
 /* 
  * app_error - Report an arbitrary application error
  */
@@ -1011,14 +2398,21 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvValpcsdo] [-f <file>] [-t <dir>] [-j <n>] [-T <n>]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-c         Convert the traces to binary <trace>.bin files.\n");
+    fprintf(stderr, "\t-d         Defer coalescing in the mm package.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-j <n>     Also replay each trace on <n> threads at once.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-o         Keep the free lists of the mm package in address order.\n");
+    fprintf(stderr, "\t-p         Print latency percentiles of each request type.\n");
+    fprintf(stderr, "\t-s         Stream each trace from its file and replay it once.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-T <n>     Sample the heap every <n> requests into <trace>.csv.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
 }
@@ -1,10 +1,22 @@
 /*
- * memlib.c - a module that simulates the memory system.  Needed because it 
- *            allows us to interleave calls from the student's malloc package 
+ * memlib.c - a module that simulates the memory system.  Needed because it
+ *            allows us to interleave calls from the student's malloc package
  *            with the system's malloc package in libc.
+ *
+ * The heap lives in arenas: ranges of address space reserved with mmap.
+ * Pages of an arena are committed only as its brk moves up, and given back
+ * to the OS when it moves down again.  mem_sbrk works on the current
+ * arena; when that one is full, the malloc package opens a new one with
+ * mem_new_arena, so the heap is not bounded by any one reservation.
+ * Huge blocks bypass the arenas: mem_map gives each one a mapping of its
+ * own, which mem_remap can grow or shrink without copying.  A part of the
+ * package that needs addresses of its own, apart from the heap, reserves
+ * an arena for itself with mem_reserve.
  */
+#define _GNU_SOURCE           /* for mremap */
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <assert.h>
 #include <unistd.h>
 #include <sys/mman.h>
@@ -14,82 +26,306 @@
 #include "memlib.h"
 #include "config.h"
 
+/* MADV_FREE lets the OS take pages lazily; older kernels only drop them */
+#ifdef MADV_FREE
+#define RELEASE_ADVICE MADV_FREE
+#else
+#define RELEASE_ADVICE MADV_DONTNEED
+#endif
+
+/* The pages past the brk of an arena are given back only once there are
+   release_min bytes of them.  release_min starts at RELEASE_MIN and
+   doubles, up to RELEASE_MAX, every time a brk grows back over pages it
+   gave back, so a heap that keeps shrinking and growing again soon stops
+   paying the OS for it. */
+#define RELEASE_MIN (1 << 17)
+#define RELEASE_MAX (1 << 25)
+
+/* An arena and the part of it in use */
+typedef struct arena {
+    char *start;          /* first byte of the arena */
+    char *brk;            /* points to last byte of heap, plus one */
+    char *committed;      /* end of the pages ever made accessible */
+    char *in_use;         /* end of the pages used since last given back */
+    char *max_addr;       /* end of the reservation */
+    struct arena *next;   /* the arena opened before this one */
+} arena_t;
+
+/* A mapping made by mem_map.  The record sits at the start of the mapping,
+   MAP_HDR bytes before the address handed out. */
+typedef struct mapping {
+    size_t len;           /* bytes mapped, a multiple of the page size */
+    struct mapping *prev; /* neighbours in the list of mappings */
+    struct mapping *next;
+} mapping_t;
+
+#define MAP_HDR ((sizeof(mapping_t) + 15) & ~(size_t)15)
+#define MAPPING_OF(p) ((mapping_t *)((char *)(p) - MAP_HDR))
+
 /* private variables */
-static char *mem_start_brk;  /* points to first byte of heap */
-static char *mem_brk;        /* points to last byte of heap */
-static char *mem_max_addr;   /* largest legal heap address */ 
+static arena_t *arenas;       /* current arena, first of the list */
+static arena_t first_arena;   /* the arena opened by mem_init */
+static arena_t *reserves;     /* arenas of mem_reserve, newest first */
+static mapping_t *mappings;   /* mappings of mem_map, newest first */
+static size_t heap_size;      /* bytes of heap over all arenas */
+static size_t heap_peak;      /* largest heap_size since the last reset */
+static size_t page_size;
+static size_t release_min = RELEASE_MIN;
 
-/* 
+/* private helpers */
+static arena_t *new_arena(size_t size);
+static void free_arena(arena_t *a);
+static int open_arena(arena_t *a, size_t size);
+static void *arena_sbrk(arena_t *a, intptr_t incr);
+static void close_arena(arena_t *a);
+static void round_to_page(char **p);
+static void link_mapping(mapping_t *m);
+static void unlink_mapping(mapping_t *m);
+static size_t mapping_len(size_t size);
+
+/*
  * mem_init - initialize the memory system model
  */
 void mem_init(void)
 {
-    /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
-	fprintf(stderr, "mem_init_vm: malloc error\n");
+    page_size = (size_t)getpagesize();
+
+    /* reserve the address space of the first arena */
+    if (open_arena(&first_arena, ARENA_SIZE) < 0) {
+	fprintf(stderr, "mem_init_vm: mmap error\n");
 	exit(1);
     }
-
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
-    mem_brk = mem_start_brk;                  /* heap is empty initially */
+    arenas = &first_arena;
+    reserves = NULL;
+    mappings = NULL;
+    heap_size = heap_peak = 0;
 }
 
-/* 
+/*
  * mem_deinit - free the storage used by the memory system model
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+    mem_reset_brk();
+    close_arena(&first_arena);
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_reset_brk - reset the simulated brk pointer to make an empty heap.
+ *    Arenas opened after the first one, those of mem_reserve and all
+ *    mappings are released; the pages of the first arena stay committed,
+ *    so that the next run does not fault them in again.
  */
 void mem_reset_brk()
 {
-    mem_brk = mem_start_brk;
+    arena_t *a;
+
+    while (mappings != NULL)
+	mem_unmap((char *)mappings + MAP_HDR);
+    while ((a = reserves) != NULL) {
+	reserves = a->next;
+	free_arena(a);
+    }
+
+    while ((a = arenas) != &first_arena) {
+	arenas = a->next;
+	free_arena(a);
+    }
+    first_arena.brk = first_arena.start;
+    heap_size = heap_peak = 0;
 }
 
-/* 
- * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+/*
+ * mem_sbrk - simple model of the sbrk function. Extends the heap
+ *    by incr bytes and returns the start address of the new area.  A
+ *    negative incr shrinks the heap, and the whole pages beyond the new
+ *    brk are handed back to the OS once there are release_min bytes of
+ *    them.
  */
-void *mem_sbrk(intptr_t incr) 
+void *mem_sbrk(intptr_t incr)
 {
-    char *old_brk = mem_brk;
+    return arena_sbrk(arenas, incr);
+}
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
-	errno = ENOMEM;
-	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
-	return (void *)-1;
+/*
+ * mem_reserve - reserve an arena of at least size bytes for a part of the
+ *    malloc package that needs addresses of its own, apart from the heap
+ *    of mem_sbrk.  Returns the start of the arena, or NULL if no address
+ *    space could be reserved.
+ */
+void *mem_reserve(size_t size)
+{
+    arena_t *a;
+
+    if ((a = new_arena(size)) == NULL)
+	return NULL;
+    a->next = reserves;
+    reserves = a;
+    return a->start;
+}
+
+/*
+ * mem_reserve_sbrk - mem_sbrk for the arena of mem_reserve that starts at
+ *    base
+ */
+void *mem_reserve_sbrk(void *base, intptr_t incr)
+{
+    arena_t *a;
+
+    for (a = reserves; a->start != (char *)base; a = a->next)
+	;
+    return arena_sbrk(a, incr);
+}
+
+/*
+ * mem_new_arena - open a new arena of at least size bytes, which becomes
+ *    the current arena of mem_sbrk.  Returns 0 for success or -1 if no
+ *    address space could be reserved.
+ */
+int mem_new_arena(size_t size)
+{
+    arena_t *a;
+
+    if ((a = new_arena(size > ARENA_SIZE ? size : ARENA_SIZE)) == NULL)
+	return -1;
+    a->next = arenas;
+    arenas = a;
+    return 0;
+}
+
+/*
+ * mem_map - map a region of at least size bytes of its own, outside the
+ *    arenas.  Returns its address, aligned to 16 bytes, or NULL if the
+ *    OS has no memory left.
+ */
+void *mem_map(size_t size)
+{
+    size_t len = mapping_len(size);
+    mapping_t *m;
+
+    m = mmap(NULL, len, PROT_READ | PROT_WRITE,
+	     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (m == MAP_FAILED)
+	return NULL;
+    m->len = len;
+    link_mapping(m);
+    return (char *)m + MAP_HDR;
+}
+
+/*
+ * mem_unmap - give the region p of mem_map back to the OS
+ */
+void mem_unmap(void *p)
+{
+    mapping_t *m = MAPPING_OF(p);
+
+    unlink_mapping(m);
+    munmap(m, m->len);
+}
+
+/*
+ * mem_remap - resize the region p of mem_map to at least size bytes,
+ *    keeping its contents.  The OS moves the pages rather than copying
+ *    them where it can.  Returns the new address of the region, or NULL
+ *    (with p left as it was) if the OS has no memory left.
+ */
+void *mem_remap(void *p, size_t size)
+{
+    mapping_t *m = MAPPING_OF(p);
+    size_t len = mapping_len(size);
+    void *q;
+
+    if (len == m->len)
+	return p;
+    unlink_mapping(m);
+#ifdef MREMAP_MAYMOVE
+    if ((q = mremap(m, m->len, len, MREMAP_MAYMOVE)) == MAP_FAILED) {
+	link_mapping(m);
+	return NULL;
     }
-    mem_brk += incr;
-    return (void *)old_brk;
+#else
+    q = mmap(NULL, len, PROT_READ | PROT_WRITE,
+	     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (q == MAP_FAILED) {
+	link_mapping(m);
+	return NULL;
+    }
+    memcpy(q, m, len < m->len ? len : m->len);
+    munmap(m, m->len);
+#endif
+    m = (mapping_t *)q;
+    m->len = len;
+    link_mapping(m);
+    return (char *)m + MAP_HDR;
 }
 
 /*
- * mem_heap_lo - return address of the first heap byte
+ * mem_heap_lo - return address of the first heap byte of the current arena
  */
 void *mem_heap_lo()
 {
-    return (void *)mem_start_brk;
+    return (void *)arenas->start;
 }
 
-/* 
- * mem_heap_hi - return address of last heap byte
+/*
+ * mem_heap_hi - return address of last heap byte of the current arena
  */
 void *mem_heap_hi()
 {
-    return (void *)(mem_brk - 1);
+    return (void *)(arenas->brk - 1);
+}
+
+/*
+ * mem_heap_clean - return the end of the pages of the current arena that
+ *    were ever committed.  The arena is all zero from there on, as those
+ *    pages are still as the OS first mapped them.
+ */
+void *mem_heap_clean()
+{
+    return (void *)arenas->committed;
 }
 
 /*
- * mem_heapsize() - returns the heap size in bytes
+ * mem_is_heap - returns 1 if the bytes lo ... hi lie in the heap of one
+ *    arena (including those of mem_reserve) or in one mapping, and 0
+ *    otherwise
  */
-size_t mem_heapsize() 
+int mem_is_heap(void *lo, void *hi)
 {
-    return (size_t)(mem_brk - mem_start_brk);
+    arena_t *a;
+    mapping_t *m;
+
+    if (lo > hi)
+	return 0;
+    for (a = arenas; a != NULL; a = a->next)
+	if ((char *)lo >= a->start && (char *)hi < a->brk)
+	    return 1;
+    for (a = reserves; a != NULL; a = a->next)
+	if ((char *)lo >= a->start && (char *)hi < a->brk)
+	    return 1;
+    for (m = mappings; m != NULL; m = m->next)
+	if ((char *)lo >= (char *)m + MAP_HDR && (char *)hi < (char *)m + m->len)
+	    return 1;
+    return 0;
+}
+
+/*
+ * mem_heapsize() - returns the heap size in bytes, over all arenas and
+ *    mappings
+ */
+size_t mem_heapsize()
+{
+    return heap_size;
+}
+
+/*
+ * mem_heap_peak() - returns the largest heap size in bytes since the heap
+ *    was last reset.  The heap can shrink, so this, rather than the final
+ *    heap size, is its high water mark.
+ */
+size_t mem_heap_peak()
+{
+    return heap_peak;
 }
 
 /*
@@ -99,3 +335,163 @@ size_t mem_pagesize()
 {
     return (size_t)getpagesize();
 }
+
+/*
+ * arena_sbrk - move the brk of the arena a by incr bytes, committing or
+ *    releasing pages, and return the old brk
+ */
+static void *arena_sbrk(arena_t *a, intptr_t incr)
+{
+    char *old_brk = a->brk;
+    char *old_committed = a->committed;
+    char *end;
+
+    if ((incr > 0 && incr > a->max_addr - a->brk) ||
+	(incr < 0 && -incr > a->brk - a->start)) {
+	errno = ENOMEM;
+	return (void *)-1;
+    }
+    a->brk += incr;
+    heap_size += incr;
+    if (heap_size > heap_peak)
+	heap_peak = heap_size;
+
+    /* commit the pages the heap has grown into ... */
+    if (a->brk > a->committed) {
+	end = a->brk;
+	round_to_page(&end);
+	if (mprotect(a->committed, end - a->committed,
+		     PROT_READ | PROT_WRITE) < 0) {
+	    a->brk = old_brk;
+	    heap_size -= incr;
+	    errno = ENOMEM;
+	    return (void *)-1;
+	}
+	a->committed = end;
+    }
+    if (a->brk > a->in_use) {
+	end = a->brk;
+	round_to_page(&end);
+	if (a->in_use < old_committed && release_min < RELEASE_MAX)
+	    release_min *= 2;	/* pages given back are in use again */
+	a->in_use = end;
+    }
+
+    /* ... or give back the pages it has left.  They stay mapped, and the
+       OS reclaims them only when it runs short of memory, so a heap that
+       grows right back does not fault them in again.  Pages given back
+       before and not used since are left alone. */
+    if (incr < 0) {
+	end = a->brk;
+	round_to_page(&end);
+	if (end < a->in_use && (size_t)(a->in_use - end) >= release_min) {
+	    madvise(end, a->in_use - end, RELEASE_ADVICE);
+	    a->in_use = end;
+	}
+    }
+    return (void *)old_brk;
+}
+
+/*
+ * new_arena - open an arena of size bytes, with a record of its own.
+ *    The record is mapped rather than taken from malloc, which may be
+ *    the malloc package itself (see mmshim.c).  Returns NULL if there is
+ *    no address space left.
+ */
+static arena_t *new_arena(size_t size)
+{
+    void *p;
+
+    p = mmap(NULL, sizeof(arena_t), PROT_READ | PROT_WRITE,
+	     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+	return NULL;
+    if (open_arena((arena_t *)p, size) < 0) {
+	munmap(p, sizeof(arena_t));
+	return NULL;
+    }
+    return (arena_t *)p;
+}
+
+/*
+ * free_arena - close an arena of new_arena and unmap its record
+ */
+static void free_arena(arena_t *a)
+{
+    close_arena(a);
+    munmap(a, sizeof(arena_t));
+}
+
+/*
+ * open_arena - reserve size bytes (rounded up to whole pages) of address
+ *    space for the arena a, with nothing committed yet
+ */
+static int open_arena(arena_t *a, size_t size)
+{
+    void *p;
+
+    size = (size + page_size - 1) & ~(page_size - 1);
+    p = mmap(NULL, size, PROT_NONE,
+	     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED)
+	return -1;
+    a->start = a->brk = a->committed = a->in_use = (char *)p;
+    a->max_addr = a->start + size;
+    a->next = NULL;
+    return 0;
+}
+
+/*
+ * close_arena - give the address space of the arena a back to the OS
+ */
+static void close_arena(arena_t *a)
+{
+    heap_size -= a->brk - a->start;
+    munmap(a->start, a->max_addr - a->start);
+}
+
+/*
+ * round_to_page - round the address *p up to a page boundary
+ */
+static void round_to_page(char **p)
+{
+    *p = (char *)(((uintptr_t)*p + page_size - 1) & ~(uintptr_t)(page_size - 1));
+}
+
+/*
+ * link_mapping - add the mapping m to the list, and its pages to the heap
+ */
+static void link_mapping(mapping_t *m)
+{
+    m->prev = NULL;
+    m->next = mappings;
+    if (mappings != NULL)
+	mappings->prev = m;
+    mappings = m;
+    heap_size += m->len;
+    if (heap_size > heap_peak)
+	heap_peak = heap_size;
+}
+
+/*
+ * unlink_mapping - take the mapping m off the list, and its pages off the
+ *    heap
+ */
+static void unlink_mapping(mapping_t *m)
+{
+    if (m->prev != NULL)
+	m->prev->next = m->next;
+    else
+	mappings = m->next;
+    if (m->next != NULL)
+	m->next->prev = m->prev;
+    heap_size -= m->len;
+}
+
+/*
+ * mapping_len - the length of a mapping holding size bytes after its record
+ */
+static size_t mapping_len(size_t size)
+{
+    return (size + MAP_HDR + page_size - 1) & ~(page_size - 1);
+}
@@ -1,8 +1,17 @@
 void mem_init(void);               
 void mem_deinit(void);
 void *mem_sbrk(intptr_t incr);
+int mem_new_arena(size_t size);
+void *mem_reserve(size_t size);
+void *mem_reserve_sbrk(void *base, intptr_t incr);
+void *mem_map(size_t size);
+void mem_unmap(void *p);
+void *mem_remap(void *p, size_t size);
 void mem_reset_brk(void); 
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
+void *mem_heap_clean(void);
+int mem_is_heap(void *lo, void *hi);
 size_t mem_heapsize(void);
+size_t mem_heap_peak(void);
 size_t mem_pagesize(void);
@@ -3,12 +3,18 @@
  * blocks on a 64-bit processor.  However, 16-byte alignment is stricter
  * than necessary; the assignment only requires 8-byte alignment.  The
  * minimum block size taken is 4 words.
+ * Only free blocks carry a footer.  An allocated block has just its header,
+ * and the header of every block records whether the previous block is
+ * allocated, which is all coalescing needs to know about it.
  * This allocator uses the size of a pointer, e.g., sizeof(void *), to
- * define the size of a word.  This allocator also uses the standard
- * type uintptr_t to define unsigned integers that are the same size
- * as a pointer, i.e., sizeof(uintptr_t) == sizeof(void *).
+ * define the size of a word.  Headers and footers, though, are tags of
+ * 32 bits, tag_t, whatever the size of a word: on a 64-bit processor a
+ * block takes 4 bytes of header rather than 8, the header sitting in the
+ * last 4 bytes of the doubleword in front of the payload.  A heap block
+ * therefore has at most MAX_BLOCK bytes.
  */
 
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -30,32 +36,59 @@ team_t team = {
 };
 
 //* Basic constants and macros: */
-#define WSIZE      sizeof(void *) /* Word and header/footer size (bytes) */
+#define WSIZE      sizeof(void *) /* Word size (bytes) */
 #define DSIZE      (2 * WSIZE)    /* Doubleword size (bytes) */
-#define CHUNKSIZE  (1 << 12)      /* Extend heap by this amount (bytes) */
+#define TSIZE      sizeof(tag_t)  /* Header/footer size (bytes) */
+#define CHUNKSIZE  (1 << 12)      /* Extend heap by at least this amount (bytes) */
 
-/*Max value of 2 values*/
+/*Max and min value of 2 values*/
 #define MAX(x, y) ((x) > (y) ? (x) : (y))
+#define MIN(x, y) ((x) < (y) ? (x) : (y))
 
-/* Pack a size and allocated bit into a word */
+/* A header or footer, and the largest block size one can hold */
+typedef uint32_t tag_t;
+#define MAX_BLOCK  ((size_t)(tag_t)-1 & ~(DSIZE - 1))
+
+/* Pack a size and allocated bit into a tag */
 #define PACK(size, alloc)  ((size) | (alloc))
 
-/* Read and write a word at address p. */
-#define GET(p)       (*(uintptr_t *)(p))
-#define PUT(p, val)  (*(uintptr_t *)(p) = (val))
+/* Header bit telling that the previous block is allocated */
+#define PREV_ALLOC  0x2
+
+/* Header bit of an allocated block that mm_realloc has grown before */
+#define GROWN       0x4
+
+/* Read and write a tag at address p. */
+#define GET(p)       (*(tag_t *)(p))
+#define PUT(p, val)  (*(tag_t *)(p) = (val))
 
 /* Read the size and allocated fields from address p */
 #define GET_SIZE(p)   (GET(p) & ~(DSIZE - 1))
 #define GET_ALLOC(p)  (GET(p) & 0x1)
+#define GET_PREV_ALLOC(p)  (GET(p) & PREV_ALLOC)
+#define GET_GROWN(p)       (GET(p) & GROWN)
+#define GET_FLAGS(p)       (GET(p) & (PREV_ALLOC | GROWN))
+
+/* Set or clear the previous-block-allocated bit of the header at p.  This,
+   and the trimming of a realloc reserve, are the changes the header of an
+   allocated block sees while its owner may be reading the allocated bit
+   without the heap lock, hence the atomic (but, with only lock holders
+   writing, not read-modify-write) access. */
+#define GET_ATOMIC(p)      __atomic_load_n((tag_t *)(p), __ATOMIC_RELAXED)
+#define PUT_ATOMIC(p, val) __atomic_store_n((tag_t *)(p), (val), __ATOMIC_RELAXED)
+#define SET_PREV_ALLOC(p)  PUT_ATOMIC(p, GET_ATOMIC(p) | PREV_ALLOC)
+#define CLR_PREV_ALLOC(p)  PUT_ATOMIC(p, GET_ATOMIC(p) & ~(tag_t)PREV_ALLOC)
 
 
-/* Given block ptr bp, compute address of its header and footer */
-#define HDRP(bp)  ((void *)(bp) - WSIZE)
-#define FTRP(bp)  ((void *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
+/* Given block ptr bp, compute address of its header and footer (free
+   blocks only) */
+#define HDRP(bp)  ((void *)(bp) - TSIZE)
+#define FTRP(bp)  ((void *)(bp) + GET_SIZE(HDRP(bp)) - 2 * TSIZE)
 
-/* Given block ptr bp, compute address of next and previous blocks */
+/* Given block ptr bp, compute address of next and previous blocks (the
+   previous block must be free) */
 #define NEXT_BLK(bp)  ((void *)(bp) + GET_SIZE(HDRP(bp)))
-#define PREV_BLK(bp)  ((void *)(bp) - GET_SIZE((void *)(bp) - DSIZE))
+#define PREV_BLK(bp)  ((void *)(bp) - GET_SIZE((void *)(bp) - 2 * TSIZE))
 
 /* Given ptr in free list, get next and previous ptr in the list */
 /* bp is address of the free block. Since minimum Block size is 16 bytes, 
@@ -68,24 +101,349 @@ team_t team = {
 #define SET_NEXT_PTR(bp, qp) (GET_NEXT_PTR(bp) = qp)
 #define SET_PREV_PTR(bp, qp) (GET_PREV_PTR(bp) = qp)
 
+/* Free blocks of at least LARGE_BLOCK bytes are not kept in the segregated
+   lists but in a splay tree keyed by block size.  Their payload holds the
+   two children after the list pointers; blocks whose size is already in the
+   tree hang off that tree node through the list pointers instead. */
+#define LARGE_BLOCK  (1 << 10)
+#define GET_LEFT_PTR(bp)   (*(char **)((bp) + 2 * WSIZE))
+#define GET_RIGHT_PTR(bp)  (*(char **)((bp) + 3 * WSIZE))
+#define SET_LEFT_PTR(bp, qp)  (GET_LEFT_PTR(bp) = (qp))
+#define SET_RIGHT_PTR(bp, qp) (GET_RIGHT_PTR(bp) = (qp))
+
+/* Number of segregated free lists.  Below LARGE_BLOCK there is one list per
+   block size, list i holding the free blocks of i * DSIZE bytes, so the
+   head of any list that is large enough is a fit.  A bitmap of the
+   non-empty lists finds the next one in a few word operations. */
+#define NUM_CLASSES  (LARGE_BLOCK / DSIZE)
+#define MIN_BLOCK    (2 * DSIZE)
+#define MAP_BITS     (8 * sizeof(unsigned long))
+#define MAP_WORDS    ((NUM_CLASSES + MAP_BITS - 1) / MAP_BITS)
+
+/* A block that keeps growing through mm_realloc is given GROW_NUM/GROW_DEN
+   times the requested size.  The unused reserve of up to GROW_SLOTS such
+   blocks is remembered, so that it can be returned to the free lists
+   before the heap has to grow.  A huge block has its mapping resized
+   without a copy, so its reserve only saves calls to the OS, and is
+   held to at most HUGE_RESERVE bytes, which count against the heap. */
+#define GROW_NUM     3
+#define GROW_DEN     2
+#define GROW_SLOTS   8
+#define HUGE_RESERVE (1 << 16)
+
+/* The heap is a chain of segments, one per memlib arena, each between its
+   own prologue and epilogue.  Only the last block of the current arena can
+   grow with mem_sbrk; a free block there of at least TRIM_THRESHOLD bytes
+   is given back to the OS, but for TRIM_KEEP bytes. */
+#define SEG_OVERHEAD    (2 * DSIZE)
+#define TRIM_THRESHOLD  (1 << 17)
+#define TRIM_KEEP       CHUNKSIZE
+#define AT_HEAP_END(bp) ((char *)(bp) == (char *)mem_heap_hi() + 1)
+
+/* The padding word in front of the prologue of a segment links it to the
+   prologue of the segment before, so that the checker can walk them all */
+#define SEG_PREV(seg)   (*(char **)((char *)(seg) - DSIZE))
+
+/* The heap grows by what the free block at its end lacks, but by at least
+   grow_chunk bytes.  grow_chunk starts at CHUNKSIZE and doubles every time
+   the heap grows, up to CHUNK_MAX or 1/CHUNK_SHARE of the heap, so a heap
+   that keeps growing takes fewer mem_sbrk calls.  It is back at CHUNKSIZE
+   once the end of the heap is given back to the OS.  What is left of the
+   last chunk counts against the peak heap, so CHUNK_MAX stays small. */
+#define CHUNK_MAX       (1 << 13)
+#define CHUNK_SHARE     32
+
+/* A block of at least HUGE_BLOCK bytes is not taken from the heap but gets
+   a mapping of its own (see mem_map), with the block pointer DSIZE bytes
+   into it.  Its header is just the HUGE bit, with the allocated bit clear,
+   which tells it from any heap block or object; the length of the mapping,
+   which a tag may be too small for, is in the word at its start. */
+#define HUGE_BLOCK   (1 << 17)
+#define HUGE         0x2
+#define IS_HUGE(bp)  ((GET_ATOMIC(HDRP(bp)) & 0x3) == HUGE)
+#define HUGE_LEN(bp) (*(size_t *)((char *)(bp) - DSIZE))
+
+/* Objects of up to SLAB_MAX bytes do not take a heap block but come from
+   slab pages: SLAB_PAGE bytes, aligned to their size, cut into objects of
+   one size class SLAB_STEP bytes apart, with no header at all.  The page
+   record at the start of a page is found by masking an object's address.
+   Slab pages have an arena of their own (see mem_reserve), so an address
+   in that arena is what tells mm_free an object of a slab. */
+#define SLAB_PAGE     (1 << 12)
+#define SLAB_MAX      32
+#define SLAB_STEP     8
+#define SLAB_CLASSES  (SLAB_MAX / SLAB_STEP)
+#define SLAB_SPAN     ((size_t)1 << (sizeof(void *) == 8 ? 30 : 24))
+
+/* Given an object ptr bp, tell whether it is in a slab and find its page */
+#define IS_SLAB(bp)   ((char *)(bp) >= slab_lo && (char *)(bp) < slab_end)
+#define SLAB_OF(bp)   ((slab_t *)((uintptr_t)(bp) & ~(uintptr_t)(SLAB_PAGE - 1)))
+
+typedef struct slab {
+  struct slab *prev;        /* neighbours in the list of pages of the */
+  struct slab *next;        /*   same size that have free objects */
+  char *free;               /* objects freed */
+  char *bump;               /* first object never handed out */
+  char *end;                /* where the objects of the page end */
+  size_t osize;             /* size of every object */
+  int used;                 /* objects handed out and not freed */
+} slab_t;
+
 /* Global declarations */
 static char *heap_listp = 0; 
-static char *free_list_start = 0;
+static char *last_seg = NULL;  /* prologue of the newest segment */
+static char *seg_lists[NUM_CLASSES];
+static unsigned long class_map[MAP_WORDS];
+static char *tree_root = 0;
+static size_t tree_max = 0;   /* size of the largest block in the tree */
+static size_t grow_chunk = CHUNKSIZE;
+
+/* The current arena is all zero from mem_heap_clean on.  When grow_heap
+   makes a block partly out of such bytes, it leaves in zero_from the
+   address from which the payload of the block is known to be zero, but
+   for the one tag where a footer was; mm_calloc clears only the rest. */
+static char *zero_from = NULL;
+
+/* The arena of slab pages, the pages of each size class with free
+   objects (current first), and the empty pages, which have no size yet */
+static char *slab_lo = NULL;
+static char *slab_end = NULL;
+static slab_t *slab_lists[SLAB_CLASSES];
+static slab_t *slab_empty = NULL;
+
+/* In deferred mode a freed heap block of up to QUICK_MAX bytes is not
+   coalesced but pushed on the quick list of its size, still marked as
+   allocated, so that the next request of that size takes it back at
+   once.  The quick lists are freed and coalesced all together when a
+   search of the free lists fails, or when they hold more than
+   QUICK_BUDGET bytes. */
+#define QUICK_MAX      512
+#define QUICK_CLASSES  (QUICK_MAX / DSIZE + 1)
+#define QUICK_BUDGET   (1 << 16)
+
+static int deferred = 0;
+static char *quick_lists[QUICK_CLASSES];
+
+/* In address-ordered mode a size class list is kept sorted by address,
+   as a splay tree on the two pointers of its blocks (the previous
+   pointer is the left child, the next pointer the right one), and
+   blocks of one size in the tree of large blocks are ordered by address
+   rather than chained.  Every search then takes the lowest block that
+   fits, which packs live blocks towards the bottom of the heap. */
+static int ordered = 0;
+
+/* Blocks of at least line_min bytes of payload start on a cache line of
+   MM_CACHE_LINE bytes (0 for none) */
+static size_t line_min = 0;
+
+/* Blocks holding a realloc reserve, and the block size they actually need */
+static void *reserve_blk[GROW_SLOTS];
+static size_t reserve_live[GROW_SLOTS];
+static int reserve_victim = 0;
+
+/* In multithreaded mode every thread serves blocks of up to TCACHE_MAX bytes
+   from its own thread pages: TPAGE_SIZE blocks of the heap cut into objects
+   of a single block size.  An object has a header like any block, but with
+   the allocated bit clear and the offset of the object from its page in
+   place of the size, which is how mm_free tells it from a heap block. */
+#define TPAGE_SIZE   (1 << 14)
+#define TCACHE_MAX   512
+#define TC_CLASSES   (TCACHE_MAX / DSIZE + 1)
+
+/* Given an object ptr bp, find its page */
+#define IS_OBJECT(bp)  (!(GET_ATOMIC(HDRP(bp)) & 0x3))
+#define PAGE_OF(bp)    ((tpage_t *)((char *)(bp) - GET_SIZE(HDRP(bp))))
+
+struct tcache;
+
+typedef struct tpage {
+  struct tcache *owner;     /* thread cache the page belongs to */
+  struct tpage *prev;       /* neighbours in the owner's list of pages */
+  struct tpage *next;       /*   for the same block size */
+  char *free;               /* objects freed by the owner */
+  char *bump;               /* first object never handed out */
+  char *end;                /* where the objects of the page end */
+  size_t asize;             /* block size of every object */
+  int used;                 /* objects handed out and not freed */
+} tpage_t;
+
+typedef struct tcache {
+  tpage_t *pages[TC_CLASSES];  /* pages of each block size, current first */
+  char *remote;                /* objects freed by other threads: a stack
+                                  pushed lock-free, emptied by the owner */
+  struct tcache *next;         /* next abandoned cache */
+} tcache_t;
+
+/* The heap behind the thread caches is shared, and guarded by heap_lock
+   in multithreaded mode.  A cache whose thread has exited is abandoned and
+   handed to the next new thread.  mm_init starts a new generation of the
+   heap, which invalidates every cache of the old one. */
+static int threaded = 0;
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t cache_once = PTHREAD_ONCE_INIT;
+static pthread_key_t cache_key;
+static unsigned heap_gen = 0;
+static tcache_t *abandoned = NULL;
+static __thread tcache_t *my_cache = NULL;
+static __thread unsigned my_cache_gen = 0;
+
+#define LOCK()    do { if (threaded) pthread_mutex_lock(&heap_lock); } while (0)
+#define UNLOCK()  do { if (threaded) pthread_mutex_unlock(&heap_lock); } while (0)
+
+/* A region is a list of chunks, blocks taken with mm_malloc, and bumps a
+   pointer through the newest of them.  Chunks start at REGION_CHUNK bytes
+   of block and double up to REGION_CHUNK_MAX; a block of more than a
+   quarter of that gets a chunk of its own.  The region record sits in its
+   first chunk, and every chunk starts with a link to the one before. */
+#define REGION_CHUNK      (1 << 12)
+#define REGION_CHUNK_MAX  (1 << 16)
+#define REGION_HDR        (DSIZE * ((sizeof(rchunk_t) + DSIZE - 1) / DSIZE))
+
+typedef struct rchunk {
+  struct rchunk *next;      /* chunk taken before this one */
+} rchunk_t;
+
+struct mm_region {
+  char *bump;               /* next free byte of the newest chunk */
+  char *end;                /* where the newest chunk ends */
+  rchunk_t *chunks;         /* chunks of the region, newest first */
+  size_t next_size;         /* block size of the next chunk */
+};
+
+/* The statistics of mm_stats.  mm_stats reads them without the heap
+   lock, so every field is a word written with an atomic store.  Only
+   the heap lock holders change them, but for the realloc counters, which
+   thread caches also count on their own, with an atomic add.  The room
+   on slab pages that holds no object is kept apart, as it is no free
+   heap block but is not in use either. */
+static mm_stats_t stats;
+static size_t slab_spare = 0;
+
+#define STAT_LOAD(f)       __atomic_load_n(&(f), __ATOMIC_RELAXED)
+#define STAT_ADD(f, n)     __atomic_store_n(&(f), (f) + (n), __ATOMIC_RELAXED)
+#define STAT_SUB(f, n)     __atomic_store_n(&(f), (f) - (n), __ATOMIC_RELAXED)
+#define STAT_ADD_SHARED(f, n)  __atomic_fetch_add(&(f), (n), __ATOMIC_RELAXED)
+
+/* In a build with MM_DEBUG defined, every allocated heap block ends in a
+   canary tag, where it would have its footer if it were free, and so
+   does every object of a thread page; its free checks it, and
+   mm_usable_size leaves it out.  (Slab objects have none.)  The blocks
+   of the heap that change are
+   logged in "touched", so that mm_check need only look at those.  A block
+   that takes in the boundary of another is touched along with it, and
+   lies below it, so an address of the log is either still a block or
+   inside a lower block of the log.  When more than TOUCH_MAX blocks
+   change between two checks, the next one walks the whole heap. */
+#ifdef MM_DEBUG
+#define GUARD        TSIZE
+#define CANARY(bp)   ((tag_t)(uintptr_t)(bp) ^ (tag_t)0x5bd1e995)
+#define SET_GUARD(bp)    PUT(FTRP(bp), CANARY(bp))
+#define CHECK_GUARD(bp)  check_guard(bp, FTRP(bp))
+#define SET_OBJ_GUARD(bp, asize) \
+  PUT((char *)(bp) + (asize) - 2 * TSIZE, CANARY(bp))
+#define CHECK_OBJ_GUARD(bp) \
+  check_guard(bp, (char *)(bp) + PAGE_OF(bp)->asize - 2 * TSIZE)
+#define TOUCH(bp)        touch(bp)
+#define TOUCH_MAX    (1 << 12)
+
+static char *touched[TOUCH_MAX];
+static int num_touched = 0;   /* TOUCH_MAX + 1 once the log overflowed */
+#else
+#define GUARD        0
+#define SET_GUARD(bp)    ((void)0)
+#define CHECK_GUARD(bp)  ((void)0)
+#define SET_OBJ_GUARD(bp, asize)  ((void)0)
+#define CHECK_OBJ_GUARD(bp)       ((void)0)
+#define TOUCH(bp)        ((void)0)
+#endif
+
+/* Errors the checker and the canaries found since mm_check last ran,
+   counted with an atomic add, as an object is freed without the lock */
+static int check_errors = 0;
+
+/* Function prototypes for the heap behind the thread caches */
+static void *heap_malloc(size_t size);
+static void *heap_alloc(size_t asize);
+static size_t heap_alloc_batch(size_t asize, size_t n, void **ptrs);
+static void heap_free(void *bp);
+static void heap_free_batch(void **ptrs, size_t n);
+static void free_block(void *bp);
+static void *heap_realloc(void *bp, size_t size);
+
+/* Function prototypes for huge blocks */
+static void *huge_malloc(size_t size);
+static void huge_free(void *bp);
+static void *huge_realloc(void *bp, size_t size);
+
+/* Function prototypes for the slab pages of tiny objects */
+static void *slab_malloc(size_t size);
+static void slab_free(void *bp);
+static slab_t *slab_new(size_t osize);
+
+/* Function prototypes for the thread caches */
+static tcache_t *my_tcache(void);
+static void make_cache_key(void);
+static void abandon_cache(void *tc);
+static void *tc_malloc(size_t asize);
+static void tc_free(void *bp);
+static void tc_free_local(tcache_t *tc, char *bp);
+static void tc_drain(tcache_t *tc);
+static tpage_t *tc_refill(tcache_t *tc, size_t asize);
+
+/* Function prototypes for regions */
+static rchunk_t *region_chunk(size_t size);
 
 /* Function prototypes for internal helper routines */
 static void *coalesce(void *bp);
 static void *extend_heap(size_t words);
+static void *grow_heap(size_t asize);
+static char *open_segment(void);
+static void release_tail(void *bp);
 static void *find_fit(size_t asize);
 static void place(void *bp, size_t asize);
+static size_t carve_run(void *bp, size_t asize, size_t n, void **ptrs);
+static size_t adjust_size(size_t size);
+static void trim_block(void *bp, size_t asize);
+static char *align_in(char *bp, size_t asize, size_t alignment);
+static void *aligned_fit(size_t asize, size_t alignment);
+
+/* Function prototypes for the quick lists of deferred mode */
+static int quick_free(void *bp);
+static int flush_quick(void);
+
+/* Function prototypes for the reserve of growing blocks */
+static void keep_reserve(void *bp, size_t asize);
+static void drop_reserve(void *bp);
+static void release_reserve(int slot);
+static int release_reserves(void);
 
 /* Function prototypes for maintaining free list*/
+static int size_class(size_t size);
+static void sort_addrs(void **a, size_t n);
+static int stat_bin(size_t size);
 static void insert_in_free_list(void *bp); 
 static void remove_from_free_list(void *bp); 
+static char *addr_splay(char *t, char *bp);
+
+/* Function prototypes for the tree of large free blocks */
+static int tree_cmp(size_t size, char *bp, char *t);
+static char *splay(char *t, size_t size, char *bp);
+static void insert_in_tree(char *bp);
+static void remove_from_tree(char *bp);
+static void *tree_best_fit(size_t asize);
 
 /* Function prototypes for heap consistency checker routines: */
-static void checkblock(void *bp);
+static int checkblock(void *bp);
 static void checkheap(bool verbose);
+static int in_free_list(char *bp);
+static int is_block(char *bp);
+static void check_error(void *bp, char *msg);
 static void printblock(void *bp); 
+#ifdef MM_DEBUG
+static void check_touched(void);
+static void check_guard(void *bp, void *canary);
+static void touch(void *bp);
+#endif
 
 /**
  * Initialize the memory manager.
@@ -93,24 +451,118 @@ static void printblock(void *bp);
  * @return - int 0 for success or -1 for failure
  */
 int mm_init(void) {
-  
+  int i;
+
+  /* Thread caches of a previous heap are gone with it */
+  heap_gen++;
+  abandoned = NULL;
+
   /* Create the initial empty heap. */
-  if ((heap_listp = mem_sbrk(8*WSIZE)) == NULL) 
+  last_seg = NULL;
+  if ((heap_listp = open_segment()) == NULL) 
     return -1;
 
-  PUT(heap_listp, 0);                            /* Alignment padding */
-  PUT(heap_listp + (1 * WSIZE), PACK(DSIZE, 1)); /* Prologue header */ 
-  PUT(heap_listp + (2 * WSIZE), PACK(DSIZE, 1)); /* Prologue footer */ 
-  PUT(heap_listp + (3 * WSIZE), PACK(0, 1));     /* Epilogue header */
-  free_list_start = heap_listp + 2*WSIZE; 
+  /* Every size class starts out empty */
+  for (i = 0; i < (int)NUM_CLASSES; i++)
+    seg_lists[i] = NULL;
+  for (i = 0; i < (int)MAP_WORDS; i++)
+    class_map[i] = 0;
+  tree_root = NULL;
+  tree_max = 0;
+  grow_chunk = CHUNKSIZE;
+  for (i = 0; i < GROW_SLOTS; i++)
+    reserve_blk[i] = NULL;
+  for (i = 0; i < (int)QUICK_CLASSES; i++)
+    quick_lists[i] = NULL;
+  memset(&stats, 0, sizeof(stats));
+  slab_spare = 0;
+  check_errors = 0;
+#ifdef MM_DEBUG
+  num_touched = 0;
+#endif
 
-  /* Extend the empty heap with a free block of minimum possible block size */
-  if (extend_heap(4) == NULL){ 
-    return -1;
-  }
+  /* Slab pages start out in an empty arena; without one, tiny objects
+     come from the heap like any other */
+  slab_lo = mem_reserve(SLAB_SPAN);
+  slab_end = slab_lo == NULL ? NULL : slab_lo + SLAB_SPAN;
+  for (i = 0; i < SLAB_CLASSES; i++)
+    slab_lists[i] = NULL;
+  slab_empty = NULL;
+
+  /* The heap gets its first block with the first request that needs one */
   return 0;
 }
 
+/*
+ * Requires:
+ *   No other thread is using the allocator, and no block is allocated.
+ *
+ * Effects:
+ *   Switches multithreaded mode on or off.  In multithreaded mode the
+ *   allocator may be called from any number of threads; small blocks are
+ *   served from per-thread caches and the heap behind them is locked.
+ */
+void mm_set_threaded(int on){
+  threaded = on;
+}
+
+/*
+ * Effects:
+ *   Switches deferred coalescing on or off.  In deferred mode freeing a
+ *   small heap block only pushes it on a quick list of its size, and the
+ *   blocks of the quick lists are coalesced in batches.  Switching it
+ *   off coalesces the blocks waiting there.
+ */
+void mm_set_deferred(int on){
+  LOCK();
+  deferred = on;
+  if (!on && heap_listp != NULL)
+    flush_quick();
+  UNLOCK();
+}
+
+/*
+ * Effects:
+ *   Switches the free lists between LIFO and address order.  The free
+ *   blocks already there are taken out and put back in the new order.
+ */
+void mm_set_address_ordered(int on){
+  char *bp, *stack = NULL;
+  int i;
+
+  LOCK();
+  if (heap_listp != NULL && on != ordered) {
+    for (i = 0; i < (int)NUM_CLASSES; i++)
+      while ((bp = seg_lists[i]) != NULL) {
+        remove_from_free_list(bp);
+        *(char **)bp = stack;
+        stack = bp;
+      }
+    while ((bp = tree_root) != NULL) {
+      remove_from_free_list(bp);
+      *(char **)bp = stack;
+      stack = bp;
+    }
+  }
+  ordered = on;
+  while ((bp = stack) != NULL) {
+    stack = *(char **)bp;
+    insert_in_free_list(bp);
+  }
+  UNLOCK();
+}
+
+/*
+ * Effects:
+ *   Makes being cache-line aligned a property of the size classes of at
+ *   least "min_size" bytes: from now on mm_malloc hands out every block
+ *   of that size or more, short of a huge block, at an address that is
+ *   a multiple of MM_CACHE_LINE.  With "min_size" 0, no size class is.
+ */
+void mm_set_line_aligned(size_t min_size){
+  line_min = min_size;
+}
+
 /* 
  * Requires:
  *   size of memory asked by the programmer.
@@ -118,317 +570,2257 @@ int mm_init(void) {
  * Effects:
  *   Allocate a block with at least "size" bytes of payload, unless "size" is
  *   zero.  Returns the address of this block if the allocation was successful
- *   and NULL otherwise.
+ *   and NULL otherwise.  Tiny objects come from slab pages.  In
+ *   multithreaded mode small blocks, tiny ones included, come from the
+ *   calling thread's cache instead, without taking the heap lock.
  */
 void *mm_malloc(size_t size) 
 {
-  size_t asize;      /* Adjusted block size */
-  size_t extendsize; /* Amount to extend heap if no fit */
   void *bp;
 
-  /* Ignore spurious requests. */
   if (size == 0)
     return (NULL);
+  if (line_min != 0 && size >= line_min && size < HUGE_BLOCK - DSIZE)
+    return mm_memalign(MM_CACHE_LINE, size);
+  if (!threaded) {
+    if (size <= SLAB_MAX && (bp = slab_malloc(size)) != NULL)
+      return bp;
+    return heap_malloc(size);
+  }
+  if (adjust_size(size) <= TCACHE_MAX && (bp = tc_malloc(adjust_size(size))) != NULL)
+    return bp;
+  LOCK();
+  bp = heap_malloc(size);
+  UNLOCK();
+  return bp;
+}
 
-  /* Adjust block size to include overhead and alignment reqs. */
-  if (size <= DSIZE)
-    asize = 2 * DSIZE;
-  else
-    asize = DSIZE * ((size + DSIZE + (DSIZE - 1)) / DSIZE);
+/*
+ * Effects:
+ *   Allocate a block for an array of "nmemb" elements of "size" bytes,
+ *   with every byte zero, unless the array is empty or too large.
+ *   Returns the address of this block if the allocation was successful
+ *   and NULL otherwise.  A huge block has fresh pages, and a heap block
+ *   made out of bytes the heap never had before is cleared only where
+ *   the allocator wrote to it (see zero_from); any other block is cleared
+ *   in full.
+ */
+void *mm_calloc(size_t nmemb, size_t size)
+{
+  size_t bytes, asize;
+  char *bp, *zero, *foot;
 
-  /* Search the free list for a fit. */
-  if ((bp = find_fit(asize)) != NULL) {
-    place(bp, asize);
-    return (bp);
+  if (nmemb != 0 && size > (size_t)-1 / nmemb)
+    return NULL;
+  if ((bytes = nmemb * size) == 0)
+    return NULL;
+  asize = adjust_size(bytes);
+  if ((threaded ? asize <= TCACHE_MAX : bytes <= SLAB_MAX) ||
+      (line_min != 0 && bytes >= line_min && asize < HUGE_BLOCK)) {
+    if ((bp = mm_malloc(bytes)) != NULL)
+      memset(bp, 0, bytes);
+    return bp;
   }
 
-  /* No fit found.  Get more memory and place the block. */
-  extendsize = MAX(asize, CHUNKSIZE);
-  if ((bp = extend_heap(extendsize / WSIZE)) == NULL)  
-    return (NULL);
-  place(bp, asize);
-  return (bp);
-} 
+  LOCK();
+  zero_from = NULL;
+  bp = heap_malloc(bytes);
+  zero = asize >= HUGE_BLOCK ? bp : zero_from;
+  UNLOCK();
+  if (bp == NULL || zero == bp)
+    return bp;
+  if (zero == NULL || zero >= bp + bytes) {
+    memset(bp, 0, bytes);
+    return bp;
+  }
+  memset(bp, 0, zero - bp);
+  foot = FTRP(bp);
+  if (foot < bp + bytes)
+    memset(foot, 0, MIN(TSIZE, (size_t)(bp + bytes - foot)));
+  return bp;
+}
+
+/*
+ * Effects:
+ *   Allocate "n" blocks with at least "size" bytes of payload each, unless
+ *   "size" is zero, and store their addresses in "ptrs".  Returns the number
+ *   of blocks allocated, which is less than "n" only if memory ran out;
+ *   those blocks are the first entries of "ptrs".  Tiny objects and the
+ *   blocks of the thread caches come from their pages one by one, but
+ *   heap blocks are carved in runs out of as few free blocks as possible,
+ *   under a single lock (see heap_alloc_batch).
+ */
+size_t mm_malloc_batch(size_t size, size_t n, void **ptrs)
+{
+  size_t asize, done = 0;
+
+  if (size == 0)
+    return 0;
+  asize = adjust_size(size);
+  if (asize >= HUGE_BLOCK ||
+      (line_min != 0 && size >= line_min && size < HUGE_BLOCK - DSIZE)) {
+    while (done < n && (ptrs[done] = mm_malloc(size)) != NULL)
+      done++;
+    return done;
+  }
+  if (!threaded) {
+    if (size <= SLAB_MAX)
+      while (done < n && (ptrs[done] = slab_malloc(size)) != NULL)
+        done++;
+  }
+  else if (asize <= TCACHE_MAX)
+    while (done < n && (ptrs[done] = tc_malloc(asize)) != NULL)
+      done++;
+  if (done < n) {
+    LOCK();
+    done += heap_alloc_batch(asize, n - done, ptrs + done);
+    UNLOCK();
+  }
+  return done;
+}
 
 /* 
  * Requires:
  *   "bp" is either the address of an allocated block or NULL.
  *
  * Effects:
- *   Free a block.
+ *   Free a block.  An object of a slab or of a thread page goes back to
+ *   its page, and the mapping of a huge block back to the OS.  Objects of
+ *   a slab are told apart first, by their address, as they have no
+ *   header to look at.  In deferred mode a small heap block waits on a
+ *   quick list to be coalesced later.
  */
 void mm_free(void *bp){
-  size_t size;
-  /* Ignore spurious requests. */
   if (bp == NULL)
     return;
-  /* Free and coalesce the block. */
-  size = GET_SIZE(HDRP(bp));
-  PUT(HDRP(bp), PACK(size, 0));
-  PUT(FTRP(bp), PACK(size, 0));
-  coalesce(bp);
+  if (IS_SLAB(bp)) {
+    LOCK();
+    slab_free(bp);
+    UNLOCK();
+    return;
+  }
+  if (IS_OBJECT(bp)) {
+    tc_free(bp);
+    return;
+  }
+  LOCK();
+  if (IS_HUGE(bp))
+    huge_free(bp);
+  else if (!deferred || !quick_free(bp))
+    heap_free(bp);
+  UNLOCK();
 }
 
-/*
+/* 
  * Requires:
- *   "ptr" is either the address of an allocated block or NULL.
+ *   "bp" is either the address of an allocated block or NULL, and "size"
+ *   is at least the size last asked for it and at most mm_usable_size(bp).
  *
  * Effects:
- *   Reallocates the block "ptr" to a block with at least "size" bytes of
- *   payload, unless "size" is zero.  
- *   If "size" is zero, frees the block "ptr" and returns NULL.  
- *   If the block "ptr" is already a block with at
- *   least "size" bytes of payload, then "ptr" may optionally be returned.
- *   Further if requested size is greater than the current block size at pointer bp
- *   and we have the next block as empty with sum of current block size and next block (which happens to be empty)
- *   then we dont need call malloc but just combine current block and next block to resize them so as to 
- *   satisfy the requested realloc size. 
- *   If nothing can be done then a new block is allocated (using malloc) and the contents of the old block
- *   "ptr" are copied to that new block.  Returns the address of this new
- *   block if the allocation was successful and NULL otherwise.
+ *   Free a block whose size the caller knows, the same way as mm_free.
+ *   The size alone cannot lead to the block's bin: an object of a thread
+ *   page is found through its header, and a heap block may be larger
+ *   than the size suggests, after a split that left too little to cut
+ *   off, a trim or a realloc reserve.
  */
-void *mm_realloc(void *bp, size_t size){
-  if((int)size < 0) 
-    return NULL; 
-  else if((int)size == 0){ 
-    mm_free(bp); 
-    return NULL; 
-  } 
-  else if(size > 0){ 
-      size_t oldsize = GET_SIZE(HDRP(bp)); 
-      size_t newsize = size + 2 * WSIZE; // 2 words for header and footer
-      /*if newsize is less than oldsize then we just return bp */
-      if(newsize <= oldsize){ 
-          return bp; 
-      }
-      /*if newsize is greater than oldsize */ 
-      else { 
-          size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLK(bp))); 
-          size_t csize;
-          /* next block is free and the size of the two blocks is greater than or equal the new size  */ 
-          /* then we only need to combine both the blocks  */ 
-          if(!next_alloc && ((csize = oldsize + GET_SIZE(  HDRP(NEXT_BLK(bp))  ))) >= newsize){ 
-            remove_from_free_list(NEXT_BLK(bp)); 
-            PUT(HDRP(bp), PACK(csize, 1)); 
-            PUT(FTRP(bp), PACK(csize, 1)); 
-            return bp; 
-          }
-          else {  
-            void *new_ptr = mm_malloc(newsize);  
-            place(new_ptr, newsize);
-            memcpy(new_ptr, bp, newsize); 
-            mm_free(bp); 
-            return new_ptr; 
-          } 
-      }
-  }else 
-    return NULL;
-} 
-
+void mm_free_sized(void *bp, size_t size){
+  (void)size;
+  mm_free(bp);
+}
 
 /*
  * Requires:
- *   "bp" is the address of a newly freed block.
+ *   Every entry of "ptrs" is either the address of an allocated block or
+ *   NULL, and no block is in it twice.
  *
  * Effects:
- *   Perform boundary tag coalescing. 
- *   Removes and inserts appropiate free block pointers to the explicit free list
- *   Returns the address of the coalesced block.
+ *   Free the "n" blocks of "ptrs", in any order; the order of "ptrs" is
+ *   not kept.  Objects of the thread caches go back to their pages first,
+ *   without the heap lock.  The heap blocks are sorted by address, and
+ *   every run of them that lie next to each other is freed and coalesced
+ *   as one block, even in deferred mode.
  */
-static void *coalesce(void *bp){
+void mm_free_batch(void **ptrs, size_t n){
+  size_t i, k = 0;
+  char *bp;
 
-  //if previous block is allocated or its size is zero then PREV_ALLOC will be set.
-  size_t NEXT_ALLOC = GET_ALLOC(  HDRP(NEXT_BLK(bp))  );
-  size_t PREV_ALLOC = GET_ALLOC(  FTRP(PREV_BLK(bp))  ) || PREV_BLK(bp) == bp;
-  size_t size = GET_SIZE(HDRP(bp));
-  
-  /* Next block is only free */   
-  if (PREV_ALLOC && !NEXT_ALLOC) {                  
-    size += GET_SIZE( HDRP(NEXT_BLK(bp))  );
-    remove_from_free_list(NEXT_BLK(bp));
-    PUT(HDRP(bp), PACK(size, 0));
-    PUT(FTRP(bp), PACK(size, 0));
+  for (i = 0; i < n; i++) {
+    if ((bp = ptrs[i]) == NULL)
+      continue;
+    if (!IS_SLAB(bp) && IS_OBJECT(bp))
+      tc_free(bp);
+    else
+      ptrs[k++] = bp;
   }
-  /* Prev block is only free */  
-  else if (!PREV_ALLOC && NEXT_ALLOC) {               
-    size += GET_SIZE( HDRP(PREV_BLK(bp))  );
-    bp = PREV_BLK(bp);
-    remove_from_free_list(bp);
-    PUT(HDRP(bp), PACK(size, 0));
-    PUT(FTRP(bp), PACK(size, 0));
+  if (k == 0)
+    return;
+
+  LOCK();
+  for (i = 0, n = k, k = 0; i < n; i++) {
+    bp = ptrs[i];
+    if (IS_SLAB(bp))
+      slab_free(bp);
+    else if (IS_HUGE(bp))
+      huge_free(bp);
+    else
+      ptrs[k++] = bp;
   }
-  /* Both blocks are free */ 
-  else if (!PREV_ALLOC && !NEXT_ALLOC) {                
-    size += GET_SIZE( HDRP(PREV_BLK(bp))  ) + GET_SIZE( HDRP(NEXT_BLK(bp))  );
-    remove_from_free_list(PREV_BLK(bp));
-    remove_from_free_list(NEXT_BLK(bp));
-    bp = PREV_BLK(bp);
-    PUT(HDRP(bp), PACK(size, 0));
-    PUT(FTRP(bp), PACK(size, 0));
-  }/* lastly insert bp into free list and return bp */
-  insert_in_free_list(bp);
-  return bp;
+  heap_free_batch(ptrs, k);
+  UNLOCK();
 }
 
-/* 
+/*
  * Requires:
- *   None.
+ *   "ptr" is either the address of an allocated block or NULL.
  *
  * Effects:
- *   Extend the heap with a free block and return that block's address.
+ *   Reallocates the block "ptr" to a block with at least "size" bytes of
+ *   payload, unless "size" is zero.  
+ *   If "size" is zero, frees the block "ptr" and returns NULL.  
+ *   An object of a slab or of a thread page is kept if it holds "size"
+ *   bytes, and otherwise moved to a new block; heap blocks are resized by
+ *   heap_realloc and huge blocks by huge_realloc.  Returns the address of the resized block if the
+ *   reallocation was successful and NULL otherwise.
  */
+void *mm_realloc(void *bp, size_t size){
+  void *new_ptr;
 
-static void *extend_heap(size_t words) {
-  char *bp;
-  size_t size;
-
-  /* Allocate an even number of words to maintain alignment */
-  size = (words % 2) ? (words+1) * WSIZE : words * WSIZE;
-  //Since minimum block size given to us is 4 words (ie 16 bytes)
-  if (size < 16){
-    size = 16;
-  }
-  /* call for more memory space */
-  if ((int)(bp = mem_sbrk(size)) == -1){ 
+  if (bp == NULL)
+    return mm_malloc(size);
+  if (size == 0) {
+    mm_free(bp);
     return NULL;
   }
-  /* Initialize free block header/footer and the epilogue header */
-  PUT(HDRP(bp), PACK(size, 0));         /* free block header */
-  PUT(FTRP(bp), PACK(size, 0));         /* free block footer */
-  PUT(HDRP(NEXT_BLK(bp)), PACK(0, 1)); /* new epilogue header */
-  /* coalesce bp with next and previous blocks */
-  return coalesce(bp);
-}
-
-/*
- * Requires:
- *   Size of memory to find.
- * Effects:
- *   Finds a fit for a block with "asize" bytes from the free list.
- *   Extends the heap in some special cases.
- *   And Returns that block's address
- *   or NULL if no suitable block was found. 
- */
-
-static void *find_fit(size_t asize){
-  void *bp;
-  static int last_malloced_size = 0;
-  static int repeat_counter = 0;
-  if( last_malloced_size == (int)asize){
-      if(repeat_counter>30){  
-        int extendsize = MAX(asize, 4 * WSIZE);
-        bp = extend_heap(extendsize/4);
-        return bp;
-      }
-      else
-        repeat_counter++;
+  if (IS_SLAB(bp)) {
+    if (size <= SLAB_OF(bp)->osize) {
+      STAT_ADD_SHARED(stats.realloc_in_place, 1);
+      return bp;
+    }
+    if ((new_ptr = mm_malloc(size)) == NULL)
+      return NULL;
+    memcpy(new_ptr, bp, SLAB_OF(bp)->osize);
+    mm_free(bp);
+    STAT_ADD_SHARED(stats.realloc_copies, 1);
+    return new_ptr;
   }
-  else
-    repeat_counter = 0;
-  for (bp = free_list_start; GET_ALLOC(HDRP(bp)) == 0; bp = GET_NEXT_PTR(bp) ){
-    if (asize <= (size_t)GET_SIZE(HDRP(bp)) ) {
-      last_malloced_size = asize;
+  if (IS_OBJECT(bp)) {
+    if (adjust_size(size) <= PAGE_OF(bp)->asize) {
+      STAT_ADD_SHARED(stats.realloc_in_place, 1);
       return bp;
     }
+    if ((new_ptr = mm_malloc(size)) == NULL)
+      return NULL;
+    memcpy(new_ptr, bp, MIN(size, PAGE_OF(bp)->asize - TSIZE));
+    mm_free(bp);
+    STAT_ADD_SHARED(stats.realloc_copies, 1);
+    return new_ptr;
   }
-  return NULL;
+  LOCK();
+  if (IS_HUGE(bp))
+    new_ptr = huge_realloc(bp, size);
+  else
+    new_ptr = heap_realloc(bp, size);
+  UNLOCK();
+  return new_ptr;
 }
 
-/* 
+/*
  * Requires:
- *   "bp" is the address of a free block that is at least "asize" bytes.
+ *   "alignment" is a power of 2.
+ *
  * Effects:
- *   Place a block of "asize" bytes at the start of the free block "bp" and
- *   split that block if the remainder would be at least the minimum block
- *   size. 
+ *   Allocate a block with at least "size" bytes of payload, unless "size"
+ *   is zero, at an address that is a multiple of "alignment".  Up to
+ *   DSIZE, every block is aligned, but the objects of a slab only to
+ *   their size, so the size is rounded up to the alignment.  A stricter
+ *   alignment is carved out of a free block that holds an aligned block
+ *   of the size, if the free lists have one, or else out of a heap block
+ *   with room for a free block in front of the aligned address.  Either
+ *   way, the fragments in front and behind go back to the free lists.
+ *   Returns the address of this block if the allocation was successful
+ *   and NULL otherwise.
  */
-static void place(void *bp, size_t asize){
-  size_t csize = GET_SIZE(HDRP(bp));
+void *mm_memalign(size_t alignment, size_t size)
+{
+  size_t asize, csize, lead;
+  char *bp, *abp;
 
-  if ((csize - asize) >= 4 * WSIZE) {
-    PUT(HDRP(bp), PACK(asize, 1));
-    PUT(FTRP(bp), PACK(asize, 1));
-    remove_from_free_list(bp);
-    bp = NEXT_BLK(bp);
-    PUT(HDRP(bp), PACK(csize-asize, 0));
-    PUT(FTRP(bp), PACK(csize-asize, 0));
-    coalesce(bp);
-  }
-  else {
-    PUT(HDRP(bp), PACK(csize, 1));
-    PUT(FTRP(bp), PACK(csize, 1));
-    remove_from_free_list(bp);
-  }
-}
+  if (size == 0 || (alignment & (alignment - 1)) != 0)
+    return NULL;
+  if (alignment <= DSIZE)
+    return mm_malloc((size + alignment - 1) & ~(alignment - 1));
+  asize = adjust_size(size);
+  if (asize > MAX_BLOCK - MIN_BLOCK - alignment)
+    return NULL;
 
-/*Inserts the free block pointer int the free_list*/
-static void insert_in_free_list(void *bp){
-  SET_NEXT_PTR(bp, free_list_start); 
-  SET_PREV_PTR(free_list_start, bp); 
-  SET_PREV_PTR(bp, NULL); 
-  free_list_start = bp; 
-}
-/*Removes the free block pointer int the free_list*/
-static void remove_from_free_list(void *bp){
-  if (GET_PREV_PTR(bp))
-    SET_NEXT_PTR(GET_PREV_PTR(bp), GET_NEXT_PTR(bp));
+  LOCK();
+  if ((bp = aligned_fit(asize, alignment)) != NULL)
+    place(bp, GET_SIZE(HDRP(bp)));
   else
-    free_list_start = GET_NEXT_PTR(bp);
-  SET_PREV_PTR(GET_NEXT_PTR(bp), GET_PREV_PTR(bp));
+    bp = heap_alloc(asize + alignment + MIN_BLOCK);
+  if (bp != NULL) {
+    if ((abp = align_in(bp, asize, alignment)) != bp) {
+      lead = abp - bp;
+      csize = GET_SIZE(HDRP(bp));
+      PUT(HDRP(abp), PACK(csize - lead, 1));
+      PUT(HDRP(bp), PACK(lead, GET_PREV_ALLOC(HDRP(bp))));
+      PUT(FTRP(bp), PACK(lead, 0));
+      STAT_ADD(stats.splits, 1);
+      coalesce(bp);
+      bp = abp;
+    }
+    trim_block(bp, asize);
+  }
+  UNLOCK();
+  return bp;
 }
 
-
-/* 
- * The remaining routines are heap consistency checker routines. 
+/*
+ * Effects:
+ *   Like mm_memalign, with the checks of C11's aligned_alloc: returns
+ *   NULL unless "alignment" is a power of 2 and "size" a multiple of it.
  */
+void *mm_aligned_alloc(size_t alignment, size_t size)
+{
+  if (alignment == 0 || size % alignment != 0)
+    return NULL;
+  return mm_memalign(alignment, size);
+}
 
 /*
  * Requires:
- *   "bp" is the address of a block.
+ *   "bp" is either the address of an allocated block or NULL.
  *
  * Effects:
- *   Perform a minimal check on the block "bp".
+ *   Returns the number of bytes of payload the block "bp" really has,
+ *   which may be more than it was asked for, or 0 if "bp" is NULL.  All
+ *   of them may be used, and mm_realloc keeps the block in place for any
+ *   size up to that.  The reserve of a growing block does not count, as
+ *   it may be released at any time.  Only a block with a reserve needs
+ *   the heap lock: the size of any other one changes only when its
+ *   owner reallocates it.
  */
-static void
-checkblock(void *bp) 
-{
+size_t mm_usable_size(void *bp){
+  tag_t header;
+  size_t size;
+  int i;
 
-  if ((uintptr_t)bp % DSIZE)
-    printf("Error: %p is not doubleword aligned\n", bp);
-  if (GET(HDRP(bp)) != GET(FTRP(bp)))
-    printf("Error: header does not match footer\n");
+  if (bp == NULL)
+    return 0;
+  if (IS_SLAB(bp))
+    return SLAB_OF(bp)->osize;
+  header = GET_ATOMIC(HDRP(bp));
+  if (!(header & 0x3))
+    return PAGE_OF(bp)->asize - TSIZE - GUARD;
+  if ((header & 0x3) == HUGE)
+    return HUGE_LEN(bp) - DSIZE;
+  size = header & ~(tag_t)(DSIZE - 1);
+  if (!(header & GROWN))
+    return size - TSIZE - GUARD;
+  LOCK();
+  size = GET_SIZE(HDRP(bp));
+  for (i = 0; i < GROW_SLOTS; i++)
+    if (reserve_blk[i] == bp)
+      size = reserve_live[i];
+  UNLOCK();
+  return size - TSIZE - GUARD;
 }
 
-/* 
- * Requires:
- *   None.
- *
+/*
  * Effects:
- *   Perform a minimal check of the heap for consistency. 
+ *   Fills in "st" with the statistics of the allocator.  They are kept
+ *   up to date by every request, so this costs no walk of the heap, and
+ *   takes no lock: each figure is exact, but a request made by another
+ *   thread meanwhile may show in some of them and not yet in others.
+ *   The largest free block is the largest in the tree, or else in the
+ *   largest non-empty size class.
  */
-void
-checkheap(bool verbose) 
+void mm_stats(mm_stats_t *st){
+  unsigned long bits;
+  int i;
+
+  st->heap_size = mem_heapsize();
+  st->free_bytes = STAT_LOAD(stats.free_bytes);
+  st->free_blocks = STAT_LOAD(stats.free_blocks);
+  for (i = 0; i < MM_STAT_BINS; i++)
+    st->free_by_size[i] = STAT_LOAD(stats.free_by_size[i]);
+  st->quick_bytes = STAT_LOAD(stats.quick_bytes);
+  st->in_use = st->heap_size - st->free_bytes - st->quick_bytes -
+    STAT_LOAD(slab_spare);
+  st->sbrk_calls = STAT_LOAD(stats.sbrk_calls);
+  st->splits = STAT_LOAD(stats.splits);
+  st->coalesces = STAT_LOAD(stats.coalesces);
+  st->realloc_in_place = STAT_LOAD(stats.realloc_in_place);
+  st->realloc_copies = STAT_LOAD(stats.realloc_copies);
+
+  st->largest_free = STAT_LOAD(tree_max);
+  for (i = MAP_WORDS - 1; st->largest_free == 0 && i >= 0; i--)
+    if ((bits = STAT_LOAD(class_map[i])) != 0)
+      st->largest_free = (i * MAP_BITS + MAP_BITS - 1 - __builtin_clzl(bits)) * DSIZE;
+}
+
+/*
+ * Effects:
+ *   Checks the heap for consistency, and writes what is wrong with it to
+ *   standard error.  Every block of every segment must have a sane size
+ *   and the right bits, a free block must match its footer, have no free
+ *   neighbour and be in its free list, and the free lists and quick lists
+ *   must hold exactly the blocks the statistics count.  In a build with
+ *   MM_DEBUG defined, the canaries of allocated blocks are checked too,
+ *   and unless "full" is set only the blocks touched since the last check
+ *   are looked at.  Returns 0 if the heap is consistent and no freed block
+ *   had lost its canary since the last check, and -1 otherwise.
+ */
+int mm_check(int full){
+  int errors;
+
+  LOCK();
+  if (heap_listp != NULL) {
+#ifdef MM_DEBUG
+    if (!full && num_touched <= TOUCH_MAX)
+      check_touched();
+    else
+      checkheap(false);
+    num_touched = 0;
+#else
+    (void)full;
+    checkheap(false);
+#endif
+  }
+  errors = __atomic_exchange_n(&check_errors, 0, __ATOMIC_RELAXED);
+  UNLOCK();
+  return errors ? -1 : 0;
+}
+
+/*
+ * Effects:
+ *   Takes and releases the heap lock around a fork, so that the child
+ *   does not inherit a heap that another thread was in the middle of
+ *   changing.  Both releases run in the parent and the child alike.
+ */
+void mm_fork_lock(void){
+  LOCK();
+}
+
+void mm_fork_unlock(void){
+  UNLOCK();
+}
+
+/* 
+ * The following routines manage regions.  A region belongs to whoever
+ * created it, and must not be used by two threads at once.
+ */
+
+/*
+ * Effects:
+ *   Creates an empty region, with its first chunk.  Returns the region,
+ *   or NULL if there is no memory for it.
+ */
+mm_region_t *mm_region_create(void){
+  rchunk_t *c;
+  mm_region_t *r;
+
+  if ((c = region_chunk(REGION_CHUNK)) == NULL)
+    return NULL;
+  r = (mm_region_t *)((char *)c + REGION_HDR);
+  r->bump = (char *)r + DSIZE * ((sizeof(mm_region_t) + DSIZE - 1) / DSIZE);
+  r->end = (char *)c + mm_usable_size(c);
+  r->chunks = c;
+  r->next_size = 2 * REGION_CHUNK;
+  return r;
+}
+
+/*
+ * Requires:
+ *   "region" is a region that has not been destroyed.
+ *
+ * Effects:
+ *   Allocate a block with at least "size" bytes of payload from the
+ *   region, aligned like a block of mm_malloc, unless "size" is zero.
+ *   It lives until the region is destroyed, and must not be freed or
+ *   reallocated.  Returns the address of the block if the allocation
+ *   was successful and NULL otherwise.  A block that does not fit in the
+ *   newest chunk takes a new one, and a large block gets one of its own,
+ *   which is linked in behind the newest so that it keeps being bumped.
+ */
+void *mm_region_alloc(mm_region_t *region, size_t size){
+  size_t asize = DSIZE * ((size + DSIZE - 1) / DSIZE);
+  rchunk_t *c;
+  char *bp;
+
+  if (size == 0 || asize < size)
+    return NULL;
+  if (asize <= (size_t)(region->end - region->bump)) {
+    bp = region->bump;
+    region->bump += asize;
+    return bp;
+  }
+
+  if (asize > REGION_CHUNK_MAX / 4) {
+    if (asize > (size_t)-1 / 2 ||
+        (c = region_chunk(REGION_HDR + asize + TSIZE)) == NULL)
+      return NULL;
+    c->next = region->chunks->next;
+    region->chunks->next = c;
+    return (char *)c + REGION_HDR;
+  }
+  if ((c = region_chunk(MAX(region->next_size, REGION_HDR + asize + TSIZE))) == NULL)
+    return NULL;
+  c->next = region->chunks;
+  region->chunks = c;
+  region->next_size = MIN(2 * region->next_size, REGION_CHUNK_MAX);
+  bp = (char *)c + REGION_HDR;
+  region->bump = bp + asize;
+  region->end = (char *)c + mm_usable_size(c);
+  return bp;
+}
+
+/*
+ * Effects:
+ *   Destroys a region, unless it is NULL, and every block allocated from
+ *   it, by freeing its chunks, the one of the record last.
+ */
+void mm_region_destroy(mm_region_t *region){
+  rchunk_t *c, *next, *first;
+
+  if (region == NULL)
+    return;
+  first = (rchunk_t *)((char *)region - REGION_HDR);
+  for (c = region->chunks; c != NULL; c = next) {
+    next = c->next;
+    if (c != first)
+      mm_free(c);
+  }
+  mm_free(first);
+}
+
+/*
+ * Requires:
+ *   "size" is more than REGION_HDR + TSIZE.
+ *
+ * Effects:
+ *   Allocates a chunk, a block of at least "size" bytes, with no link yet.
+ *   Returns it, or NULL if there is no memory.
+ */
+static rchunk_t *region_chunk(size_t size){
+  rchunk_t *c;
+
+  if ((c = (rchunk_t *)mm_malloc(size - TSIZE)) != NULL)
+    c->next = NULL;
+  return c;
+}
+
+/* 
+ * Requires:
+ *   size of memory asked by the programmer, which is not zero.  The heap
+ *   lock is held in multithreaded mode.
+ *
+ * Effects:
+ *   Allocate a block with at least "size" bytes of payload from the heap,
+ *   or a huge block if it takes HUGE_BLOCK bytes or more.  Returns the
+ *   address of this block if the allocation was successful and NULL
+ *   otherwise.
+ */
+static void *heap_malloc(size_t size)
+{
+  size_t asize;      /* Adjusted block size */
+
+  /* Adjust block size to include the header and alignment reqs. */
+  asize = adjust_size(size);
+  if (asize >= HUGE_BLOCK)
+    return huge_malloc(size);
+  return heap_alloc(asize);
+}
+
+/* 
+ * Requires:
+ *   "asize" is a block size.  The heap lock is held in multithreaded mode.
+ *
+ * Effects:
+ *   Allocate a heap block of at least "asize" bytes, however large.
+ *   Returns the address of this block if the allocation was successful
+ *   and NULL otherwise.
+ */
+static void *heap_alloc(size_t asize)
+{
+  void *bp;
+
+  /* A block of the same size waiting on its quick list is the best fit */
+  if (asize <= QUICK_MAX && (bp = quick_lists[asize / DSIZE]) != NULL) {
+    quick_lists[asize / DSIZE] = *(char **)bp;
+    STAT_SUB(stats.quick_bytes, asize);
+    return bp;
+  }
+
+  /* Search the free list for a fit, with the blocks of the quick lists
+     coalesced, and then the realloc reserves back in it, if the first
+     searches fail. */
+  if ((bp = find_fit(asize)) != NULL ||
+      (flush_quick() && (bp = find_fit(asize)) != NULL) ||
+      (release_reserves() && (bp = find_fit(asize)) != NULL)) {
+    place(bp, asize);
+    return (bp);
+  }
+
+  /* No fit found.  Get more memory and place the block. */
+  if ((bp = grow_heap(asize)) == NULL)  
+    return (NULL);
+  place(bp, asize);
+  return (bp);
+} 
+
+/* 
+ * Requires:
+ *   "asize" is a block size below HUGE_BLOCK.  The heap lock is held in
+ *   multithreaded mode.
+ *
+ * Effects:
+ *   Allocate up to "n" heap blocks of "asize" bytes, store their addresses
+ *   in "ptrs" and return how many there are, "n" unless memory ran out.
+ *   Blocks of the size waiting on their quick list are taken first.  The
+ *   rest are carved in runs of up to HUGE_BLOCK bytes, each out of the
+ *   best fit for the whole run, or else for a single block.  Only when
+ *   not even one block fits, after the searches of heap_alloc, does the
+ *   heap grow, and then by the whole run at once.
+ */
+static size_t heap_alloc_batch(size_t asize, size_t n, void **ptrs)
+{
+  size_t done = 0, run;
+  void *bp;
+
+  while (done < n && asize <= QUICK_MAX &&
+         (bp = quick_lists[asize / DSIZE]) != NULL) {
+    quick_lists[asize / DSIZE] = *(char **)bp;
+    STAT_SUB(stats.quick_bytes, asize);
+    ptrs[done++] = bp;
+  }
+
+  while (done < n) {
+    run = asize * MIN(n - done, HUGE_BLOCK / asize);
+    if ((bp = find_fit(run)) == NULL && (bp = find_fit(asize)) == NULL &&
+        !(flush_quick() && (bp = find_fit(asize)) != NULL) &&
+        !(release_reserves() && (bp = find_fit(asize)) != NULL) &&
+        (bp = grow_heap(run)) == NULL)
+      break;
+    done += carve_run(bp, asize, n - done, ptrs + done);
+  }
+  return done;
+}
+
+/* 
+ * Requires:
+ *   "bp" is the address of an allocated heap block.  The heap lock is held
+ *   in multithreaded mode.
+ *
+ * Effects:
+ *   Free a block.
+ */
+static void heap_free(void *bp){
+  CHECK_GUARD(bp);
+  if (GET_GROWN(HDRP(bp)))
+    drop_reserve(bp);
+  free_block(bp);
+}
+
+/* 
+ * Requires:
+ *   "ptrs" holds "n" distinct addresses of allocated heap blocks.  The
+ *   heap lock is held in multithreaded mode.
+ *
+ * Effects:
+ *   Free the blocks.  They are sorted by address, so that the header of
+ *   the first block of every run of neighbours can take in the whole
+ *   run, which is then freed with one coalesce and one free list insert.
+ */
+static void heap_free_batch(void **ptrs, size_t n){
+  size_t i, j, size;
+  char *bp;
+
+  sort_addrs(ptrs, n);
+  for (i = 0; i < n; i = j) {
+    bp = ptrs[i];
+    size = 0;
+    for (j = i; j < n && (char *)ptrs[j] == bp + size; j++) {
+      CHECK_GUARD(ptrs[j]);
+      if (GET_GROWN(HDRP(ptrs[j])))
+        drop_reserve(ptrs[j]);
+      size += GET_SIZE(HDRP(ptrs[j]));
+    }
+    STAT_ADD(stats.coalesces, j - i - 1);
+    PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp)) | 1));
+    free_block(bp);
+  }
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of an allocated heap block.  The heap lock is held
+ *   in multithreaded mode.
+ *
+ * Effects:
+ *   Frees a block the deferred way: a small block that holds no realloc
+ *   reserve is pushed on the quick list of its size.  Returns 1 if it
+ *   was, and 0 if the block must be freed with heap_free instead.
+ */
+static int quick_free(void *bp){
+  size_t size = GET_SIZE(HDRP(bp));
+
+  if (size > QUICK_MAX || GET_GROWN(HDRP(bp)))
+    return 0;
+  CHECK_GUARD(bp);
+  *(char **)bp = quick_lists[size / DSIZE];
+  quick_lists[size / DSIZE] = bp;
+  STAT_ADD(stats.quick_bytes, size);
+  if (stats.quick_bytes > QUICK_BUDGET)
+    flush_quick();
+  return 1;
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of an allocated heap block with no reserve, or
+ *   of a block on a quick list.  The heap lock is held in multithreaded
+ *   mode.
+ *
+ * Effects:
+ *   Free and coalesce a block, giving the end of the heap back to the
+ *   OS if it is large enough.
+ */
+static void free_block(void *bp){
+  size_t size = GET_SIZE(HDRP(bp));
+
+  PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp))));
+  PUT(FTRP(bp), PACK(size, 0));
+  bp = coalesce(bp);
+  if (GET_SIZE(HDRP(bp)) >= TRIM_THRESHOLD && AT_HEAP_END(NEXT_BLK(bp)))
+    release_tail(bp);
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of an allocated heap block and "size" is not zero.
+ *   The heap lock is held in multithreaded mode.
+ *
+ * Effects:
+ *   Reallocates the block "bp" to a block with at least "size" bytes of
+ *   payload.
+ *   A block that shrinks keeps its place and gives the unused tail back
+ *   to the free lists.  A block that grows is resized in place whenever
+ *   it can be: by absorbing a free next block, by absorbing a free
+ *   previous block (the payload is moved down), or, when it is the last
+ *   block of the heap, by extending the heap just enough.
+ *   A block that grows to HUGE_BLOCK bytes or more becomes a huge block.
+ *   A block that grows for the second time is marked GROWN and from then
+ *   on gets GROW_NUM/GROW_DEN times the requested size, so a buffer grown
+ *   in small steps is moved O(log n) rather than O(n) times.  The block
+ *   keeps that reserve across later reallocs that fit in it.
+ *   If nothing can be done then a new block is allocated (using malloc) and
+ *   the old payload is copied to that new block.  Returns the address of
+ *   the resized block if the reallocation was successful and NULL otherwise.
+ */
+static void *heap_realloc(void *bp, size_t size){
+  size_t asize, gsize, oldsize, total;
+  size_t grown;
+  void *next, *prev, *new_ptr;
+
+  CHECK_GUARD(bp);
+  asize = adjust_size(size);
+  oldsize = GET_SIZE(HDRP(bp));
+  grown = GET_GROWN(HDRP(bp));
+
+  /* The block is big enough already.  A growing block keeps its reserve
+     unless it shrinks to less than half; any other block gives back what
+     is not needed */
+  if (asize <= oldsize) {
+    STAT_ADD_SHARED(stats.realloc_in_place, 1);
+    if (grown && asize >= oldsize / 2) {
+      keep_reserve(bp, asize);
+      return bp;
+    }
+    if (grown) {
+      drop_reserve(bp);
+      PUT(HDRP(bp), GET(HDRP(bp)) & ~(tag_t)GROWN);
+    }
+    trim_block(bp, asize);
+    return bp;
+  }
+
+  /* The block outgrows the heap: map it on its own from now on */
+  if (asize >= HUGE_BLOCK) {
+    if ((new_ptr = huge_malloc(size)) == NULL)
+      return NULL;
+    memcpy(new_ptr, bp, oldsize - TSIZE);
+    heap_free(bp);
+    STAT_ADD_SHARED(stats.realloc_copies, 1);
+    return new_ptr;
+  }
+
+  /* The block grows: the first time exactly, after that with a reserve */
+  gsize = asize;
+  if (grown) {
+    drop_reserve(bp);
+    gsize = adjust_size(size / GROW_DEN * GROW_NUM);
+  }
+  else
+    PUT(HDRP(bp), GET(HDRP(bp)) | GROWN);
+
+  next = NEXT_BLK(bp);
+  total = oldsize;
+  if (!GET_ALLOC(HDRP(next)))
+    total += GET_SIZE(HDRP(next));
+
+  /* Next block is free and big enough: absorb it */
+  if (total >= asize) {
+    remove_from_free_list(next);
+    PUT(HDRP(bp), PACK(total, GET_FLAGS(HDRP(bp)) | 1));
+    SET_PREV_ALLOC(HDRP(NEXT_BLK(bp)));
+    new_ptr = bp;
+    STAT_ADD_SHARED(stats.realloc_in_place, 1);
+  }
+
+  /* Previous block is free and, with the next one, big enough: move the
+     payload down into it */
+  else if (!GET_PREV_ALLOC(HDRP(bp)) &&
+           total + GET_SIZE(HDRP(PREV_BLK(bp))) >= asize) {
+    prev = PREV_BLK(bp);
+    total += GET_SIZE(HDRP(prev));
+    remove_from_free_list(prev);
+    if (!GET_ALLOC(HDRP(next)))
+      remove_from_free_list(next);
+    memmove(prev, bp, oldsize - TSIZE);
+    PUT(HDRP(prev), PACK(total, PREV_ALLOC | GROWN | 1));
+    SET_PREV_ALLOC(HDRP(NEXT_BLK(prev)));
+    new_ptr = prev;
+    STAT_ADD_SHARED(stats.realloc_copies, 1);
+  }
+
+  /* Last block of the heap, maybe followed by a free one: grow the heap
+     by the missing bytes only */
+  else if ((AT_HEAP_END(next) ||
+            (!GET_ALLOC(HDRP(next)) && AT_HEAP_END(NEXT_BLK(next)))) &&
+           mem_sbrk(gsize - total) != (void *)-1) {
+    if (total != oldsize)
+      remove_from_free_list(next);
+    PUT(HDRP(bp), PACK(gsize, GET_FLAGS(HDRP(bp)) | 1));
+    PUT(HDRP(NEXT_BLK(bp)), PACK(0, PREV_ALLOC | 1)); /* new epilogue header */
+    total = gsize;
+    new_ptr = bp;
+    STAT_ADD(stats.sbrk_calls, 1);
+    STAT_ADD_SHARED(stats.realloc_in_place, 1);
+  }
+
+  /* Nothing else works: allocate, copy the old payload and free.  With
+     its reserve, the block may have to become a huge block. */
+  else if (gsize >= HUGE_BLOCK) {
+    gsize = MIN(gsize, asize + HUGE_RESERVE);
+    if ((new_ptr = huge_malloc(gsize - TSIZE)) == NULL)
+      return NULL;
+    memcpy(new_ptr, bp, oldsize - TSIZE);
+    heap_free(bp);
+    STAT_ADD_SHARED(stats.realloc_copies, 1);
+    return new_ptr;
+  }
+  else {
+    if ((new_ptr = heap_malloc(gsize - TSIZE)) == NULL)
+      return NULL;
+    memcpy(new_ptr, bp, MIN(size, oldsize - TSIZE));
+    heap_free(bp);
+    STAT_ADD_SHARED(stats.realloc_copies, 1);
+    PUT(HDRP(new_ptr), GET(HDRP(new_ptr)) | GROWN);
+    total = GET_SIZE(HDRP(new_ptr));
+  }
+
+  /* Keep up to gsize bytes, and remember any reserve beyond asize */
+  trim_block(new_ptr, MIN(gsize, total));
+  if (GET_SIZE(HDRP(new_ptr)) - asize >= MIN_BLOCK)
+    keep_reserve(new_ptr, asize);
+  return new_ptr;
+} 
+
+/* 
+ * The following routines manage huge blocks.
+ */
+
+/*
+ * Requires:
+ *   "size" is not zero.  The heap lock is held in multithreaded mode.
+ *
+ * Effects:
+ *   Allocate a huge block with at least "size" bytes of payload in a
+ *   mapping of its own.  Returns the address of this block if the
+ *   allocation was successful and NULL otherwise.
+ */
+static void *huge_malloc(size_t size){
+  size_t len = adjust_size(size) + DSIZE - TSIZE;
+  char *bp;
+
+  if ((bp = mem_map(len)) == NULL)
+    return NULL;
+  bp += DSIZE;
+  HUGE_LEN(bp) = len;
+  PUT(HDRP(bp), HUGE);
+  return bp;
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of a huge block.  The heap lock is held in
+ *   multithreaded mode.
+ *
+ * Effects:
+ *   Free a huge block, giving its mapping back to the OS.
+ */
+static void huge_free(void *bp){
+  mem_unmap((char *)bp - DSIZE);
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of a huge block and "size" is not zero.  The heap
+ *   lock is held in multithreaded mode.
+ *
+ * Effects:
+ *   Reallocates the huge block "bp" to a block with at least "size" bytes
+ *   of payload.  A block that fits in its mapping, and does not shrink to
+ *   less than half of it, stays as it is.  Any other block that is still
+ *   huge has its mapping resized by the OS, without copying the payload,
+ *   and one that grows is given GROW_NUM/GROW_DEN times the requested size
+ *   like a grown heap block, but at most HUGE_RESERVE bytes more.  A
+ *   block that is no longer huge moves into the heap.  Returns the
+ *   address of the resized block if the reallocation was successful and
+ *   NULL otherwise.
+ */
+static void *huge_realloc(void *bp, size_t size){
+  size_t len = HUGE_LEN(bp);
+  size_t need = adjust_size(size) + DSIZE - TSIZE;
+  char *new_ptr;
+
+  if (need <= len && need >= len / 2) {
+    STAT_ADD_SHARED(stats.realloc_in_place, 1);
+    return bp;
+  }
+  if (adjust_size(size) < HUGE_BLOCK) {
+    if ((new_ptr = heap_malloc(size)) == NULL)
+      return NULL;
+    memcpy(new_ptr, bp, size);
+    huge_free(bp);
+    STAT_ADD_SHARED(stats.realloc_copies, 1);
+    return new_ptr;
+  }
+  if (need > len)
+    need = MIN(adjust_size(size / GROW_DEN * GROW_NUM),
+               adjust_size(size) + HUGE_RESERVE) + DSIZE - TSIZE;
+  if ((new_ptr = mem_remap((char *)bp - DSIZE, need)) == NULL)
+    return NULL;
+  new_ptr += DSIZE;
+  HUGE_LEN(new_ptr) = need;
+  STAT_ADD_SHARED(stats.realloc_in_place, 1);
+  return new_ptr;
+}
+
+/* 
+ * The following routines manage the slab pages of tiny objects.
+ */
+
+/*
+ * Requires:
+ *   0 < "size" <= SLAB_MAX.  The heap lock is held in multithreaded mode.
+ *
+ * Effects:
+ *   Allocate an object of at least "size" bytes from a slab page.  Returns
+ *   the address of the object, or NULL if there is no room for another
+ *   slab page.
+ */
+static void *slab_malloc(size_t size){
+  slab_t **head = &slab_lists[(size - 1) / SLAB_STEP];
+  slab_t *s = *head;
+  char *bp;
+
+  if (s == NULL &&
+      (s = slab_new((size + SLAB_STEP - 1) / SLAB_STEP * SLAB_STEP)) == NULL)
+    return NULL;
+
+  if ((bp = s->free) != NULL)
+    s->free = *(char **)bp;
+  else {
+    bp = s->bump;
+    s->bump += s->osize;
+  }
+  s->used++;
+  STAT_SUB(slab_spare, s->osize);
+
+  /* A full page leaves the list until an object of it is freed */
+  if (s->free == NULL && s->bump == s->end) {
+    *head = s->next;
+    if (*head != NULL)
+      (*head)->prev = NULL;
+  }
+  return bp;
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of an allocated object of a slab page.  The heap
+ *   lock is held in multithreaded mode.
+ *
+ * Effects:
+ *   Puts the object back on its page, which rejoins the list of its size
+ *   if it was full.  The page is emptied out for any size once it has no
+ *   object left and is not the current page of its size.
+ */
+static void slab_free(void *bp){
+  slab_t *s = SLAB_OF(bp);
+  slab_t **head = &slab_lists[(s->osize - 1) / SLAB_STEP];
+
+  if (s->free == NULL && s->bump == s->end) {
+    s->prev = NULL;
+    s->next = *head;
+    if (*head != NULL)
+      (*head)->prev = s;
+    *head = s;
+  }
+  *(char **)bp = s->free;
+  s->free = bp;
+  STAT_ADD(slab_spare, s->osize);
+
+  if (--s->used == 0 && *head != s) {
+    s->prev->next = s->next;
+    if (s->next != NULL)
+      s->next->prev = s->prev;
+    s->next = slab_empty;
+    slab_empty = s;
+  }
+}
+
+/*
+ * Requires:
+ *   The list of slab pages for objects of "osize" bytes is empty.
+ *
+ * Effects:
+ *   Makes a page of "osize" objects, an empty page or else a new one from
+ *   the slab arena, the current page of its size.  Returns that page or
+ *   NULL if the slab arena is full.
+ */
+static slab_t *slab_new(size_t osize){
+  slab_t *s;
+
+  if ((s = slab_empty) != NULL)
+    slab_empty = s->next;
+  else {
+    if (slab_lo == NULL ||
+        (s = mem_reserve_sbrk(slab_lo, SLAB_PAGE)) == (void *)-1)
+      return NULL;
+    STAT_ADD(stats.sbrk_calls, 1);
+    STAT_ADD(slab_spare, SLAB_PAGE);
+  }
+
+  s->prev = s->next = NULL;
+  s->free = NULL;
+  s->osize = osize;
+  s->used = 0;
+  s->bump = (char *)s + DSIZE * ((sizeof(slab_t) + DSIZE - 1) / DSIZE);
+  s->end = s->bump + osize * ((SLAB_PAGE - (s->bump - (char *)s)) / osize);
+  slab_lists[(osize - 1) / SLAB_STEP] = s;
+  return s;
+}
+
+/* 
+ * The following routines manage the thread caches of multithreaded mode.
+ */
+
+/*
+ * Requires:
+ *   Multithreaded mode.
+ *
+ * Effects:
+ *   Returns the cache of the calling thread, which is taken over from an
+ *   exited thread or allocated from the heap when the thread has none yet.
+ *   Returns NULL if the heap is out of memory.
+ */
+static tcache_t *my_tcache(void){
+  tcache_t *tc;
+
+  if (my_cache != NULL && my_cache_gen == heap_gen)
+    return my_cache;
+  pthread_once(&cache_once, make_cache_key);
+  LOCK();
+  if ((tc = abandoned) != NULL)
+    abandoned = tc->next;
+  else if ((tc = heap_malloc(sizeof(tcache_t))) != NULL)
+    memset(tc, 0, sizeof(tcache_t));
+  UNLOCK();
+  if (tc == NULL)
+    return NULL;
+  pthread_setspecific(cache_key, tc);
+  my_cache = tc;
+  my_cache_gen = heap_gen;
+  return tc;
+}
+
+/* Creates the key whose destructor abandons the cache of an exiting thread */
+static void make_cache_key(void){
+  pthread_key_create(&cache_key, abandon_cache);
+}
+
+/*
+ * Requires:
+ *   "tc" is the cache of the exiting calling thread.
+ *
+ * Effects:
+ *   Leaves the cache, with its pages and their live objects, to the next
+ *   thread that needs one.  A cache of an earlier heap is simply dropped.
+ */
+static void abandon_cache(void *tc){
+  if (tc != my_cache || my_cache_gen != heap_gen)
+    return;
+  LOCK();
+  ((tcache_t *)tc)->next = abandoned;
+  abandoned = tc;
+  UNLOCK();
+  my_cache = NULL;
+}
+
+/*
+ * Requires:
+ *   Multithreaded mode, and "asize" is an adjusted block size of at most
+ *   TCACHE_MAX bytes.
+ *
+ * Effects:
+ *   Hands out an object of "asize" bytes from the current page of the
+ *   calling thread, which needs no lock.  Objects other threads have freed
+ *   in the meantime are put back on their pages first.  Only when the
+ *   current page is full is another one found, under the lock.  Returns
+ *   NULL if there is no memory.
+ */
+static void *tc_malloc(size_t asize){
+  tcache_t *tc = my_tcache();
+  tpage_t *pg;
+  char *bp;
+
+  if (tc == NULL)
+    return NULL;
+  if (__atomic_load_n(&tc->remote, __ATOMIC_RELAXED) != NULL)
+    tc_drain(tc);
+  pg = tc->pages[asize / DSIZE];
+  if (pg == NULL || (pg->free == NULL && pg->bump == pg->end))
+    if ((pg = tc_refill(tc, asize)) == NULL)
+      return NULL;
+
+  if ((bp = pg->free) != NULL)
+    pg->free = *(char **)bp;
+  else {
+    bp = pg->bump;
+    pg->bump += asize;
+    PUT(HDRP(bp), (tag_t)(bp - (char *)pg));
+  }
+  SET_OBJ_GUARD(bp, asize);
+  pg->used++;
+  return bp;
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of an allocated object of a thread page.
+ *
+ * Effects:
+ *   Puts the object back on its page if the calling thread owns it.  Any
+ *   other thread pushes the object on the remote stack of the owner, with
+ *   a compare-and-swap rather than a lock, for the owner to collect.
+ */
+static void tc_free(void *bp){
+  tcache_t *tc = PAGE_OF(bp)->owner;
+  char *top;
+
+  CHECK_OBJ_GUARD(bp);
+  if (tc == my_cache) {
+    tc_free_local(tc, bp);
+    return;
+  }
+  top = __atomic_load_n(&tc->remote, __ATOMIC_RELAXED);
+  do
+    *(char **)bp = top;
+  while (!__atomic_compare_exchange_n(&tc->remote, &top, (char *)bp, true,
+                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of an allocated object of a page owned by "tc",
+ *   the cache of the calling thread.
+ *
+ * Effects:
+ *   Puts the object back on its page, without a lock.  The page goes back
+ *   to the heap once it is empty and not the current page of its size.
+ */
+static void tc_free_local(tcache_t *tc, char *bp){
+  tpage_t *pg = PAGE_OF(bp);
+
+  *(char **)bp = pg->free;
+  pg->free = bp;
+  if (--pg->used == 0 && tc->pages[pg->asize / DSIZE] != pg) {
+    LOCK();
+    pg->prev->next = pg->next;
+    if (pg->next != NULL)
+      pg->next->prev = pg->prev;
+    heap_free(pg);
+    UNLOCK();
+  }
+}
+
+/*
+ * Requires:
+ *   "tc" is the cache of the calling thread.
+ *
+ * Effects:
+ *   Takes the whole remote stack of the cache at once and puts every
+ *   object on it back on its page.
+ */
+static void tc_drain(tcache_t *tc){
+  char *bp, *next;
+
+  bp = __atomic_exchange_n(&tc->remote, NULL, __ATOMIC_ACQUIRE);
+  for (; bp != NULL; bp = next) {
+    next = *(char **)bp;
+    tc_free_local(tc, bp);
+  }
+}
+
+/*
+ * Requires:
+ *   "tc" is the cache of the calling thread, and its current page for
+ *   "asize" is missing or full.
+ *
+ * Effects:
+ *   Makes a page of "asize" objects with room the current one: a page of
+ *   the cache that has free objects, or else a new page.  Returns that page
+ *   or NULL if the heap is out of memory.
+ */
+static tpage_t *tc_refill(tcache_t *tc, size_t asize){
+  tpage_t **head = &tc->pages[asize / DSIZE];
+  tpage_t *pg;
+
+  LOCK();
+  for (pg = *head; pg != NULL; pg = pg->next)
+    if (pg->free != NULL || pg->bump != pg->end)
+      break;
+
+  if (pg == NULL) {
+    /* A new page, made of a heap block of exactly TPAGE_SIZE bytes */
+    if ((pg = heap_malloc(TPAGE_SIZE - TSIZE)) == NULL) {
+      UNLOCK();
+      return NULL;
+    }
+    pg->owner = tc;
+    pg->free = NULL;
+    pg->asize = asize;
+    pg->used = 0;
+    pg->bump = (char *)pg + DSIZE * ((sizeof(tpage_t) + TSIZE + DSIZE - 1) / DSIZE);
+    pg->end = pg->bump + asize * ((TPAGE_SIZE - TSIZE - (pg->bump - TSIZE - (char *)pg)) / asize);
+  }
+  else if (pg != *head) {
+    pg->prev->next = pg->next;
+    if (pg->next != NULL)
+      pg->next->prev = pg->prev;
+  }
+
+  if (pg != *head) {
+    pg->prev = NULL;
+    pg->next = *head;
+    if (*head != NULL)
+      (*head)->prev = pg;
+    *head = pg;
+  }
+  UNLOCK();
+  return pg;
+}
+
+
+/*
+ * Requires:
+ *   "bp" is the address of a newly freed block.
+ *
+ * Effects:
+ *   Perform boundary tag coalescing. 
+ *   Removes and inserts appropiate free block pointers to the explicit free list
+ *   The coalesced block always follows an allocated block, and the block
+ *   after it learns that its predecessor is now free.
+ *   Returns the address of the coalesced block.
+ */
+static void *coalesce(void *bp){
+
+  //the prologue is allocated, so the first block always sees prev_alloc set.
+  size_t next_alloc = GET_ALLOC(  HDRP(NEXT_BLK(bp))  );
+  size_t prev_alloc = GET_PREV_ALLOC(  HDRP(bp)  );
+  size_t size = GET_SIZE(HDRP(bp));
+  
+  /* Next block is only free */   
+  if (prev_alloc && !next_alloc) {                  
+    size += GET_SIZE( HDRP(NEXT_BLK(bp))  );
+    remove_from_free_list(NEXT_BLK(bp));
+    PUT(HDRP(bp), PACK(size, PREV_ALLOC));
+    PUT(FTRP(bp), PACK(size, 0));
+    STAT_ADD(stats.coalesces, 1);
+  }
+  /* Prev block is only free */  
+  else if (!prev_alloc && next_alloc) {               
+    size += GET_SIZE( HDRP(PREV_BLK(bp))  );
+    bp = PREV_BLK(bp);
+    remove_from_free_list(bp);
+    PUT(HDRP(bp), PACK(size, PREV_ALLOC));
+    PUT(FTRP(bp), PACK(size, 0));
+    STAT_ADD(stats.coalesces, 1);
+  }
+  /* Both blocks are free */ 
+  else if (!prev_alloc && !next_alloc) {                
+    size += GET_SIZE( HDRP(PREV_BLK(bp))  ) + GET_SIZE( HDRP(NEXT_BLK(bp))  );
+    remove_from_free_list(PREV_BLK(bp));
+    remove_from_free_list(NEXT_BLK(bp));
+    bp = PREV_BLK(bp);
+    PUT(HDRP(bp), PACK(size, PREV_ALLOC));
+    PUT(FTRP(bp), PACK(size, 0));
+    STAT_ADD(stats.coalesces, 2);
+  }/* lastly insert bp into free list and return bp */
+  CLR_PREV_ALLOC(HDRP(NEXT_BLK(bp)));
+  insert_in_free_list(bp);
+  return bp;
+}
+
+/* 
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Extend the heap with a free block and return that block's address.
+ */
+
+static void *extend_heap(size_t words) {
+  char *bp;
+  size_t size;
+
+  /* Allocate an even number of words to maintain alignment */
+  size = (words % 2) ? (words+1) * WSIZE : words * WSIZE;
+  //Since minimum block size given to us is 4 words
+  if (size < MIN_BLOCK){
+    size = MIN_BLOCK;
+  }
+  /* call for more memory space, in a new arena once the current is full */
+  if ((bp = mem_sbrk(size)) == (void *)-1) {
+    if (mem_new_arena(size + SEG_OVERHEAD) < 0 || open_segment() == NULL ||
+        (bp = mem_sbrk(size)) == (void *)-1)
+      return NULL;
+  }
+  STAT_ADD(stats.sbrk_calls, 1);
+  /* Initialize free block header/footer and the epilogue header */
+  PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp)))); /* free block header */
+  PUT(FTRP(bp), PACK(size, 0));         /* free block footer */
+  PUT(HDRP(NEXT_BLK(bp)), PACK(0, 1)); /* new epilogue header */
+  /* coalesce bp with next and previous blocks */
+  return coalesce(bp);
+}
+
+/*
+ * Requires:
+ *   "asize" is a block size that no free block fits.
+ *
+ * Effects:
+ *   Grow the heap into a free block of at least "asize" bytes at its end,
+ *   and return that block's address, or NULL if there is no more memory.
+ *   A free block already at the end is extended rather than left behind.
+ */
+
+static void *grow_heap(size_t asize) {
+  char *epilogue = (char *)mem_heap_hi() + 1 - TSIZE;
+  char *clean = mem_heap_clean();
+  size_t need = asize;
+  void *bp;
+
+  if (!GET_PREV_ALLOC(epilogue))
+    need -= MIN(need, GET_SIZE(epilogue - TSIZE));
+  if ((bp = extend_heap(MAX(need, grow_chunk) / WSIZE)) == NULL)
+    return NULL;
+  /* Only the free list pointers of the block are written above clean */
+  zero_from = MAX(clean, (char *)bp + 4 * WSIZE);
+  /* The old end stays behind if the heap moved on to a new arena */
+  if (GET_SIZE(HDRP(bp)) < asize) {
+    zero_from = NULL;
+    if ((bp = extend_heap((asize - GET_SIZE(HDRP(bp))) / WSIZE)) == NULL)
+      return NULL;
+  }
+  grow_chunk = MIN(2 * grow_chunk,
+                   MIN(CHUNK_MAX, MAX(CHUNKSIZE, mem_heapsize() / CHUNK_SHARE)));
+  return bp;
+}
+
+/*
+ * Requires:
+ *   The current arena has room for SEG_OVERHEAD more bytes.
+ *
+ * Effects:
+ *   Start a new segment at the brk of the current arena, with a prologue
+ *   and an epilogue of its own, and return the prologue's address.
+ */
+
+static char *open_segment(void) {
+  char *p;
+
+  if ((p = mem_sbrk(SEG_OVERHEAD)) == (void *)-1)
+    return NULL;
+  STAT_ADD(stats.sbrk_calls, 1);
+  *(char **)p = last_seg;                       /* Padding: the segment before */
+  PUT(p + DSIZE - TSIZE, PACK(DSIZE, 1));       /* Prologue header */
+  PUT(p + 2 * (DSIZE - TSIZE), PACK(DSIZE, 1)); /* Prologue footer */
+  PUT(p + 2 * DSIZE - TSIZE, PACK(0, PREV_ALLOC | 1)); /* Epilogue header */
+  last_seg = p + DSIZE;
+  return last_seg;
+}
+
+/*
+ * Requires:
+ *   "bp" is a free block of more than TRIM_KEEP bytes that ends at the
+ *   brk of the current arena.
+ *
+ * Effects:
+ *   Shrink the heap so that bp keeps only TRIM_KEEP bytes, giving the
+ *   pages beyond it back to the OS.
+ */
+
+static void release_tail(void *bp) {
+  size_t size = GET_SIZE(HDRP(bp));
+
+  remove_from_free_list(bp);
+  if (mem_sbrk(-(intptr_t)(size - TRIM_KEEP)) != (void *)-1) {
+    STAT_ADD(stats.sbrk_calls, 1);
+    grow_chunk = CHUNKSIZE;
+    PUT(HDRP(bp), PACK(TRIM_KEEP, GET_PREV_ALLOC(HDRP(bp))));
+    PUT(FTRP(bp), PACK(TRIM_KEEP, 0));
+    PUT(HDRP(NEXT_BLK(bp)), PACK(0, 1)); /* new epilogue header */
+  }
+  insert_in_free_list(bp);
+}
+
+/*
+ * Requires:
+ *   Size of memory to find.
+ * Effects:
+ *   Finds a fit for a block with "asize" bytes from the segregated free lists.
+ *   The smallest non-empty list of blocks of at least asize bytes gives the
+ *   best fit.  Large requests, and small ones that no list can serve, get
+ *   the best fit from the tree of large blocks.
+ *   And Returns that block's address
+ *   or NULL if no suitable block was found. 
+ */
+
+static void *find_fit(size_t asize){
+  size_t cls, word;
+  unsigned long bits;
+
+  if (asize >= LARGE_BLOCK)
+    return tree_best_fit(asize);
+
+  /* First non-empty list at or above the class of asize */
+  cls = size_class(asize);
+  word = cls / MAP_BITS;
+  bits = class_map[word] & (~0UL << (cls % MAP_BITS));
+  while (bits == 0) {
+    if (++word == MAP_WORDS)
+      return tree_best_fit(asize);
+    bits = class_map[word];
+  }
+  cls = word * MAP_BITS + __builtin_ctzl(bits);
+  if (ordered)
+    seg_lists[cls] = addr_splay(seg_lists[cls], NULL);
+  return seg_lists[cls];
+}
+
+/* 
+ * Requires:
+ *   "bp" is the address of a free block that is at least "asize" bytes.
+ * Effects:
+ *   Place a block of "asize" bytes at the start of the free block "bp" and
+ *   split that block if the remainder would be at least the minimum block
+ *   size. 
+ */
+static void place(void *bp, size_t asize){
+  size_t csize = GET_SIZE(HDRP(bp));
+
+  remove_from_free_list(bp);
+  if ((csize - asize) >= MIN_BLOCK) {
+    STAT_ADD(stats.splits, 1);
+    PUT(HDRP(bp), PACK(asize, PREV_ALLOC | 1));
+    SET_GUARD(bp);
+    bp = NEXT_BLK(bp);
+    PUT(HDRP(bp), PACK(csize-asize, PREV_ALLOC));
+    PUT(FTRP(bp), PACK(csize-asize, 0));
+    coalesce(bp);
+  }
+  else {
+    PUT(HDRP(bp), PACK(csize, PREV_ALLOC | 1));
+    SET_GUARD(bp);
+    SET_PREV_ALLOC(HDRP(NEXT_BLK(bp)));
+  }
+}
+
+/* 
+ * Requires:
+ *   "bp" is the address of a free block that is at least "asize" bytes.
+ * Effects:
+ *   Place as many blocks of "asize" bytes, up to "n", as fit in the free
+ *   block "bp", one after the other from its start, store their addresses
+ *   in "ptrs" and return how many there are.  The free block leaves its
+ *   free list once, and what is left of it goes back as one block, or to
+ *   the last block placed if it is smaller than the minimum block size.
+ */
+static size_t carve_run(void *bp, size_t asize, size_t n, void **ptrs){
+  size_t csize = GET_SIZE(HDRP(bp));
+  size_t k = MIN(n, csize / asize), i;
+
+  remove_from_free_list(bp);
+  for (i = 0; i < k; i++) {
+    PUT(HDRP(bp), PACK(asize, PREV_ALLOC | 1));
+    SET_GUARD(bp);
+    TOUCH(bp);
+    ptrs[i] = bp;
+    bp = (char *)bp + asize;
+  }
+  csize -= k * asize;
+  STAT_ADD(stats.splits, k - 1);
+  if (csize >= MIN_BLOCK) {
+    STAT_ADD(stats.splits, 1);
+    PUT(HDRP(bp), PACK(csize, PREV_ALLOC));
+    PUT(FTRP(bp), PACK(csize, 0));
+    coalesce(bp);
+  }
+  else {
+    bp = ptrs[k - 1];
+    PUT(HDRP(bp), PACK(asize + csize, PREV_ALLOC | 1));
+    SET_GUARD(bp);
+    SET_PREV_ALLOC(HDRP(NEXT_BLK(bp)));
+  }
+  return k;
+}
+
+/*
+ * Requires:
+ *   None.
+ * Effects:
+ *   Returns the size of the block that holds "size" bytes of payload: the
+ *   payload plus its header (and canary), rounded up to an aligned block
+ *   of at least the minimum size.
+ */
+static size_t adjust_size(size_t size){
+  if (size <= MIN_BLOCK - TSIZE - GUARD)
+    return MIN_BLOCK;
+  return DSIZE * ((size + TSIZE + GUARD + (DSIZE - 1)) / DSIZE);
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of an allocated block that is at least "asize"
+ *   bytes.
+ * Effects:
+ *   Shrinks the block to "asize" bytes if the remainder would be at least
+ *   the minimum block size, and frees (and coalesces) the remainder.  The
+ *   canary moves to the new end of the block.
+ */
+static void trim_block(void *bp, size_t asize){
+  size_t csize = GET_SIZE(HDRP(bp));
+
+  TOUCH(bp);
+  if ((csize - asize) < MIN_BLOCK) {
+    SET_GUARD(bp);
+    return;
+  }
+  STAT_ADD(stats.splits, 1);
+  PUT_ATOMIC(HDRP(bp), PACK(asize, GET_FLAGS(HDRP(bp)) | 1));
+  SET_GUARD(bp);
+  bp = NEXT_BLK(bp);
+  PUT(HDRP(bp), PACK(csize-asize, PREV_ALLOC));
+  PUT(FTRP(bp), PACK(csize-asize, 0));
+  coalesce(bp);
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of a block, free or about to be carved.
+ * Effects:
+ *   Returns the first address in the block "bp" that is a multiple of
+ *   "alignment" and leaves in front of it either nothing or room for a
+ *   free block, or NULL if a block of "asize" bytes there does not fit
+ *   in "bp".
+ */
+static char *align_in(char *bp, size_t asize, size_t alignment){
+  char *abp = (char *)(((uintptr_t)bp + alignment - 1) & ~(uintptr_t)(alignment - 1));
+
+  if (abp != bp && (size_t)(abp - bp) < MIN_BLOCK)
+    abp += alignment;
+  return (size_t)(abp - bp) + asize <= GET_SIZE(HDRP(bp)) ? abp : NULL;
+}
+
+/*
+ * Requires:
+ *   "alignment" is a power of 2 larger than DSIZE.
+ * Effects:
+ *   Returns a free block that holds a block of "asize" bytes aligned to
+ *   "alignment" (see align_in), or NULL.  Only the first block of each
+ *   size class and the best fit of the tree are tried, so that a miss
+ *   stays cheap; a block of asize + alignment + MIN_BLOCK bytes, which
+ *   always holds one, is left to heap_alloc.
+ */
+static void *aligned_fit(size_t asize, size_t alignment){
+  size_t cls, word;
+  unsigned long bits;
+  char *bp;
+
+  if (asize < LARGE_BLOCK) {
+    cls = size_class(asize);
+    word = cls / MAP_BITS;
+    bits = class_map[word] & (~0UL << (cls % MAP_BITS));
+    for (;;) {
+      while (bits == 0) {
+        if (++word == MAP_WORDS)
+          goto tree;
+        bits = class_map[word];
+      }
+      bp = seg_lists[word * MAP_BITS + __builtin_ctzl(bits)];
+      if (align_in(bp, asize, alignment) != NULL)
+        return bp;
+      bits &= bits - 1;
+    }
+  }
+ tree:
+  if ((bp = tree_best_fit(asize)) != NULL && align_in(bp, asize, alignment))
+    return bp;
+  return NULL;
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of a GROWN block that needs only "asize" bytes.
+ * Effects:
+ *   Remembers the reserve of the block, taking over its slot if it has one.
+ *   When all slots are taken, the reserve of another block is released
+ *   to make room.
+ */
+static void keep_reserve(void *bp, size_t asize){
+  int i, slot = -1;
+
+  for (i = 0; i < GROW_SLOTS; i++) {
+    if (reserve_blk[i] == bp) {
+      slot = i;
+      break;
+    }
+    if (reserve_blk[i] == NULL && slot < 0)
+      slot = i;
+  }
+  if (slot < 0) {
+    slot = reserve_victim;
+    reserve_victim = (reserve_victim + 1) % GROW_SLOTS;
+    release_reserve(slot);
+  }
+  reserve_blk[slot] = bp;
+  reserve_live[slot] = asize;
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of a GROWN block.
+ * Effects:
+ *   Forgets the reserve of the block, if one was remembered, without
+ *   releasing it.
+ */
+static void drop_reserve(void *bp){
+  int i;
+
+  for (i = 0; i < GROW_SLOTS; i++)
+    if (reserve_blk[i] == bp)
+      reserve_blk[i] = NULL;
+}
+
+/*
+ * Requires:
+ *   None.
+ * Effects:
+ *   Shrinks the block remembered in "slot", if any, to the size it needs
+ *   and frees the reserve.
+ */
+static void release_reserve(int slot){
+  if (reserve_blk[slot] == NULL)
+    return;
+  trim_block(reserve_blk[slot], reserve_live[slot]);
+  reserve_blk[slot] = NULL;
+}
+
+/*
+ * Requires:
+ *   None.
+ * Effects:
+ *   Releases the reserve of every growing block.  Returns the number of
+ *   reserves released.
+ */
+static int release_reserves(void){
+  int i, released = 0;
+
+  for (i = 0; i < GROW_SLOTS; i++)
+    if (reserve_blk[i] != NULL) {
+      release_reserve(i);
+      released++;
+    }
+  return released;
+}
+
+/*
+ * Requires:
+ *   The heap lock is held in multithreaded mode.
+ * Effects:
+ *   Frees and coalesces every block of the quick lists, in one pass.
+ *   Returns the number of blocks freed.
+ */
+static int flush_quick(void){
+  char *bp;
+  int i, freed = 0;
+
+  if (stats.quick_bytes == 0)
+    return 0;
+  for (i = 0; i < (int)QUICK_CLASSES; i++)
+    while ((bp = quick_lists[i]) != NULL) {
+      quick_lists[i] = *(char **)bp;
+      free_block(bp);
+      freed++;
+    }
+  STAT_SUB(stats.quick_bytes, stats.quick_bytes);
+  return freed;
+}
+
+/*
+ * Returns the index of the segregated list that holds free blocks of
+ * "size" bytes.
+ */
+static int size_class(size_t size){
+  return size / DSIZE;
+}
+
+/*
+ * Effects:
+ *   Sorts the "n" addresses of "a" in increasing order, with Shell's sort
+ *   and Knuth's gaps, which for the few dozen of a batch beats a qsort
+ *   that calls back for every comparison.
+ */
+static void sort_addrs(void **a, size_t n){
+  size_t gap = 1, i, j;
+  void *p;
+
+  while (gap < n / 3)
+    gap = 3 * gap + 1;
+  for (; gap > 0; gap /= 3)
+    for (i = gap; i < n; i++) {
+      p = a[i];
+      for (j = i; j >= gap && (uintptr_t)a[j - gap] > (uintptr_t)p; j -= gap)
+        a[j] = a[j - gap];
+      a[j] = p;
+    }
+}
+
+/*Returns the bin of mm_stats_t.free_by_size that counts a free block*/
+static int stat_bin(size_t size){
+  int bin = 8 * sizeof(unsigned long) - 1 - __builtin_clzl(size) - 5;
+
+  return bin < 0 ? 0 : MIN(bin, MM_STAT_BINS - 1);
+}
+
+/*
+ * Inserts the free block pointer at the head of its size class list, or
+ * in address-ordered mode, at the root of the list's tree
+ */
+static void insert_in_free_list(void *bp){
+  size_t size = GET_SIZE(HDRP(bp));
+  char *t;
+  int cls;
+
+  TOUCH(bp);
+  STAT_ADD(stats.free_bytes, size);
+  STAT_ADD(stats.free_blocks, 1);
+  STAT_ADD(stats.free_by_size[stat_bin(size)], size);
+  if (size >= LARGE_BLOCK) {
+    insert_in_tree(bp);
+    return;
+  }
+  cls = size_class(size);
+  if (ordered && (t = seg_lists[cls]) != NULL) {
+    t = addr_splay(t, bp);
+    if ((char *)bp < t) {
+      SET_PREV_PTR(bp, GET_PREV_PTR(t));
+      SET_NEXT_PTR(bp, t);
+      SET_PREV_PTR(t, NULL);
+    }
+    else {
+      SET_NEXT_PTR(bp, GET_NEXT_PTR(t));
+      SET_PREV_PTR(bp, t);
+      SET_NEXT_PTR(t, NULL);
+    }
+    seg_lists[cls] = bp;
+    return;
+  }
+  SET_NEXT_PTR(bp, seg_lists[cls]); 
+  if (seg_lists[cls] != NULL)
+    SET_PREV_PTR(seg_lists[cls], bp); 
+  else
+    class_map[cls / MAP_BITS] |= 1UL << (cls % MAP_BITS);
+  SET_PREV_PTR(bp, NULL); 
+  seg_lists[cls] = bp; 
+}
+/*Removes the free block pointer from its size class list*/
+static void remove_from_free_list(void *bp){
+  size_t size = GET_SIZE(HDRP(bp));
+  char *t;
+  int cls;
+
+  TOUCH(bp);
+  STAT_SUB(stats.free_bytes, size);
+  STAT_SUB(stats.free_blocks, 1);
+  STAT_SUB(stats.free_by_size[stat_bin(size)], size);
+  if (size >= LARGE_BLOCK) {
+    remove_from_tree(bp);
+    return;
+  }
+  if (ordered) {
+    /* Splay bp to the root, then join its subtrees the way
+       remove_from_tree does */
+    cls = size_class(size);
+    addr_splay(seg_lists[cls], bp);
+    if (GET_PREV_PTR(bp) == NULL)
+      t = GET_NEXT_PTR(bp);
+    else {
+      t = addr_splay(GET_PREV_PTR(bp), bp);
+      SET_NEXT_PTR(t, GET_NEXT_PTR(bp));
+    }
+    if ((seg_lists[cls] = t) == NULL)
+      class_map[cls / MAP_BITS] &= ~(1UL << (cls % MAP_BITS));
+    return;
+  }
+  if (GET_PREV_PTR(bp))
+    SET_NEXT_PTR(GET_PREV_PTR(bp), GET_NEXT_PTR(bp));
+  else {
+    cls = size_class(size);
+    if ((seg_lists[cls] = GET_NEXT_PTR(bp)) == NULL)
+      class_map[cls / MAP_BITS] &= ~(1UL << (cls % MAP_BITS));
+  }
+  if (GET_NEXT_PTR(bp))
+    SET_PREV_PTR(GET_NEXT_PTR(bp), GET_PREV_PTR(bp));
+}
+
+/*
+ * Requires:
+ *   "t" is the root of a (possibly empty) size class tree of
+ *   address-ordered mode.
+ *
+ * Effects:
+ *   Top-down splay by address, like splay: the new root is the block
+ *   "bp" if it is in the tree, or else its neighbour below or above.
+ *   With "bp" NULL, it is the lowest block.  Returns the new root.
+ */
+static char *addr_splay(char *t, char *bp){
+  char *l = NULL, *r = NULL;
+  char **lmax = &l, **rmin = &r;
+  char *y;
+
+  if (t == NULL)
+    return NULL;
+  for (;;) {
+    if (bp < t) {
+      if (GET_PREV_PTR(t) == NULL)
+        break;
+      if (bp < GET_PREV_PTR(t)) {                     /* rotate right */
+        y = GET_PREV_PTR(t);
+        SET_PREV_PTR(t, GET_NEXT_PTR(y));
+        SET_NEXT_PTR(y, t);
+        t = y;
+        if (GET_PREV_PTR(t) == NULL)
+          break;
+      }
+      *rmin = t;                                      /* link right */
+      rmin = &GET_PREV_PTR(t);
+      t = GET_PREV_PTR(t);
+    }
+    else if (bp > t) {
+      if (GET_NEXT_PTR(t) == NULL)
+        break;
+      if (bp > GET_NEXT_PTR(t)) {                     /* rotate left */
+        y = GET_NEXT_PTR(t);
+        SET_NEXT_PTR(t, GET_PREV_PTR(y));
+        SET_PREV_PTR(y, t);
+        t = y;
+        if (GET_NEXT_PTR(t) == NULL)
+          break;
+      }
+      *lmax = t;                                      /* link left */
+      lmax = &GET_NEXT_PTR(t);
+      t = GET_NEXT_PTR(t);
+    }
+    else
+      break;
+  }
+  *lmax = GET_PREV_PTR(t);                            /* reassemble */
+  *rmin = GET_NEXT_PTR(t);
+  SET_PREV_PTR(t, l);
+  SET_NEXT_PTR(t, r);
+  return t;
+}
+
+
+/* 
+ * The following routines maintain the tree of large free blocks.
+ */
+
+/*
+ * Orders a block of "size" bytes at "bp" against the tree node "t": by
+ * size, then in address-ordered mode by address, with a NULL "bp" below
+ * every block.  Returns a negative, zero or positive number.
+ */
+static inline int tree_cmp(size_t size, char *bp, char *t){
+  size_t tsize = GET_SIZE(HDRP(t));
+
+  if (size != tsize)
+    return size < tsize ? -1 : 1;
+  if (!ordered || bp == t)
+    return 0;
+  return bp < t ? -1 : 1;
+}
+
+/*
+ * Requires:
+ *   "t" is the root of a (possibly empty) subtree of large free blocks.
+ *
+ * Effects:
+ *   Top-down splay: rearranges the subtree so that its root is the node
+ *   of "size" bytes at "bp" (see tree_cmp) if there is one, or else the
+ *   next smaller or next larger node.  Returns the new root.
+ */
+static char *splay(char *t, size_t size, char *bp){
+  char *l = NULL, *r = NULL;      /* left and right trees built on the way */
+  char **lmax = &l, **rmin = &r;  /* where the next node of each is hung */
+  char *y;
+  int c;
+
+  if (t == NULL)
+    return NULL;
+  for (;;) {
+    if ((c = tree_cmp(size, bp, t)) < 0) {
+      if (GET_LEFT_PTR(t) == NULL)
+        break;
+      if (tree_cmp(size, bp, GET_LEFT_PTR(t)) < 0) {  /* rotate right */
+        y = GET_LEFT_PTR(t);
+        SET_LEFT_PTR(t, GET_RIGHT_PTR(y));
+        SET_RIGHT_PTR(y, t);
+        t = y;
+        if (GET_LEFT_PTR(t) == NULL)
+          break;
+      }
+      *rmin = t;                                      /* link right */
+      rmin = &GET_LEFT_PTR(t);
+      t = GET_LEFT_PTR(t);
+    }
+    else if (c > 0) {
+      if (GET_RIGHT_PTR(t) == NULL)
+        break;
+      if (tree_cmp(size, bp, GET_RIGHT_PTR(t)) > 0) { /* rotate left */
+        y = GET_RIGHT_PTR(t);
+        SET_RIGHT_PTR(t, GET_LEFT_PTR(y));
+        SET_LEFT_PTR(y, t);
+        t = y;
+        if (GET_RIGHT_PTR(t) == NULL)
+          break;
+      }
+      *lmax = t;                                      /* link left */
+      lmax = &GET_RIGHT_PTR(t);
+      t = GET_RIGHT_PTR(t);
+    }
+    else
+      break;
+  }
+  *lmax = GET_LEFT_PTR(t);                            /* reassemble */
+  *rmin = GET_RIGHT_PTR(t);
+  SET_LEFT_PTR(t, l);
+  SET_RIGHT_PTR(t, r);
+  return t;
+}
+
+/*
+ * Inserts a large free block into the tree, or into the chain of its
+ * size (in address-ordered mode there are no chains)
+ */
+static void insert_in_tree(char *bp){
+  size_t size = GET_SIZE(HDRP(bp));
+  char *t;
+
+  SET_PREV_PTR(bp, NULL);
+  SET_NEXT_PTR(bp, NULL);
+  if (size > tree_max)
+    __atomic_store_n(&tree_max, size, __ATOMIC_RELAXED);
+  if (tree_root == NULL) {
+    SET_LEFT_PTR(bp, NULL);
+    SET_RIGHT_PTR(bp, NULL);
+    tree_root = bp;
+    return;
+  }
+  t = tree_root = splay(tree_root, size, bp);
+  if (!ordered && size == GET_SIZE(HDRP(t))) {
+    /* Same size as the root: link bp right behind it */
+    SET_NEXT_PTR(bp, GET_NEXT_PTR(t));
+    SET_PREV_PTR(bp, t);
+    if (GET_NEXT_PTR(t))
+      SET_PREV_PTR(GET_NEXT_PTR(t), bp);
+    SET_NEXT_PTR(t, bp);
+    return;
+  }
+  if (tree_cmp(size, bp, t) < 0) {
+    SET_LEFT_PTR(bp, GET_LEFT_PTR(t));
+    SET_RIGHT_PTR(bp, t);
+    SET_LEFT_PTR(t, NULL);
+  }
+  else {
+    SET_RIGHT_PTR(bp, GET_RIGHT_PTR(t));
+    SET_LEFT_PTR(bp, t);
+    SET_RIGHT_PTR(t, NULL);
+  }
+  tree_root = bp;
+}
+
+/*Removes a large free block from the tree*/
+static void remove_from_tree(char *bp){
+  char *next, *t;
+
+  /* A chained block is unlinked without touching the tree */
+  if (GET_PREV_PTR(bp)) {
+    SET_NEXT_PTR(GET_PREV_PTR(bp), GET_NEXT_PTR(bp));
+    if (GET_NEXT_PTR(bp))
+      SET_PREV_PTR(GET_NEXT_PTR(bp), GET_PREV_PTR(bp));
+    return;
+  }
+  tree_root = splay(tree_root, GET_SIZE(HDRP(bp)), bp);  /* bp is the root */
+  if ((next = GET_NEXT_PTR(bp)) != NULL) {
+    /* The first chained block of the same size takes bp's place */
+    SET_PREV_PTR(next, NULL);
+    SET_LEFT_PTR(next, GET_LEFT_PTR(bp));
+    SET_RIGHT_PTR(next, GET_RIGHT_PTR(bp));
+    tree_root = next;
+  }
+  else if (GET_LEFT_PTR(bp) == NULL) {
+    if ((tree_root = GET_RIGHT_PTR(bp)) == NULL)
+      __atomic_store_n(&tree_max, 0, __ATOMIC_RELAXED);
+  }
+  else {
+    /* Splaying the left subtree brings its largest block to the top,
+       which leaves that block's right child free for bp's right subtree.
+       Without one, bp was the largest block, and that block is now. */
+    t = splay(GET_LEFT_PTR(bp), GET_SIZE(HDRP(bp)), bp);
+    if (GET_RIGHT_PTR(bp) == NULL)
+      __atomic_store_n(&tree_max, GET_SIZE(HDRP(t)), __ATOMIC_RELAXED);
+    SET_RIGHT_PTR(t, GET_RIGHT_PTR(bp));
+    tree_root = t;
+  }
+}
+
+/*
+ * Requires:
+ *   Size of memory to find.
+ * Effects:
+ *   Returns the smallest large free block of at least "asize" bytes, or
+ *   NULL if there is none.  A chained block is preferred over the tree
+ *   node of the same size, because it can be removed without splaying.
+ *   In address-ordered mode it is the lowest of the smallest blocks.
+ */
+static void *tree_best_fit(size_t asize){
+  char *t;
+
+  if (tree_root == NULL)
+    return NULL;
+  t = tree_root = splay(tree_root, asize, NULL);
+  if (GET_SIZE(HDRP(t)) < asize) {
+    /* The root is the largest block that is too small; its successor is
+       the leftmost block of its right subtree */
+    if ((t = GET_RIGHT_PTR(t)) == NULL)
+      return NULL;
+    while (GET_LEFT_PTR(t) != NULL)
+      t = GET_LEFT_PTR(t);
+  }
+  return GET_NEXT_PTR(t) ? GET_NEXT_PTR(t) : t;
+}
+
+
+/* 
+ * The remaining routines are heap consistency checker routines. 
+ */
+
+/*
+ * Requires:
+ *   "bp" is the address of a block, or what looks like one.  The heap lock
+ *   is held in multithreaded mode.
+ *
+ * Effects:
+ *   Check the block "bp" and its boundary with the next block, as far as
+ *   that can be done without walking the heap: its size, the bits the
+ *   next block keeps of it, its canary if it is allocated, and if it is
+ *   free its footer, its neighbours and its place in the free lists.
+ *   Returns 0 if the next block can be found from it, and -1 otherwise.
+ */
+static int
+checkblock(void *bp) 
 {
-  void *bp;
+  size_t size = GET_SIZE(HDRP(bp));
+  char *next;
 
-  if (verbose)
-    printf("Heap (%p):\n", heap_listp);
+  if ((uintptr_t)bp % DSIZE) {
+    check_error(bp, "is not doubleword aligned");
+    return -1;
+  }
+  if (size < MIN_BLOCK || !mem_is_heap(HDRP(bp), (char *)bp + size - 1)) {
+    check_error(bp, "has a bad size");
+    return -1;
+  }
+  next = NEXT_BLK(bp);
+  if (!GET_PREV_ALLOC(HDRP(next)) != !GET_ALLOC(HDRP(bp)))
+    check_error(next, "has the wrong previous-block-allocated bit");
+  if (GET_ALLOC(HDRP(bp))) {
+#ifdef MM_DEBUG
+    if (GET(FTRP(bp)) != CANARY(bp))
+      check_error(bp, "has lost its canary: its payload overflowed");
+#endif
+    return 0;
+  }
+  if (GET(FTRP(bp)) != PACK(size, 0) || GET_GROWN(HDRP(bp)))
+    check_error(bp, "is free and its header does not match its footer");
+  if (!GET_PREV_ALLOC(HDRP(bp)) || !GET_ALLOC(HDRP(next)))
+    check_error(bp, "is free next to a free block");
+  if (!in_free_list(bp))
+    check_error(bp, "is free and not in its free list");
+  return 0;
+}
 
-  if (GET_SIZE(HDRP(heap_listp)) != DSIZE ||
-      !GET_ALLOC(HDRP(heap_listp)))
-    printf("Bad prologue header\n");
-  checkblock(heap_listp);
+/* 
+ * Requires:
+ *   The heap lock is held in multithreaded mode.
+ *
+ * Effects:
+ *   Check the whole heap for consistency, printing every block if
+ *   "verbose" is set: every block of every segment, newest first, between
+ *   its prologue and epilogue.  The free blocks found must be the ones
+ *   the free lists hold, the largest of them the one tree_max names, and
+ *   the quick lists must hold allocated blocks of their size only.
+ */
+static void
+checkheap(bool verbose) 
+{
+  char *seg, *bp;
+  size_t free_blocks = 0, free_bytes = 0, largest = 0, quick = 0;
+  size_t allocated = 0, n;
+  int i;
 
-  for (bp = heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = (void *)NEXT_BLKP(bp)) {
+  for (seg = last_seg; seg != NULL; seg = SEG_PREV(seg)) {
     if (verbose)
-      printblock(bp);
-    checkblock(bp);
+      printf("Segment (%p):\n", seg);
+    if (GET(HDRP(seg)) != PACK(DSIZE, 1) || GET(FTRP(seg)) != PACK(DSIZE, 1) ||
+        !GET_PREV_ALLOC(HDRP(seg + DSIZE)))
+      check_error(seg, "is a bad prologue");
+    for (bp = seg + DSIZE; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLK(bp)) {
+      if (verbose)
+        printblock(bp);
+      if (checkblock(bp) < 0)
+        break;
+      if (GET_ALLOC(HDRP(bp)))
+        allocated++;
+      else {
+        free_blocks++;
+        free_bytes += GET_SIZE(HDRP(bp));
+        if (GET_SIZE(HDRP(bp)) >= LARGE_BLOCK)
+          largest = MAX(largest, GET_SIZE(HDRP(bp)));
+      }
+    }
+    if (GET_SIZE(HDRP(bp)) == 0) {
+      if (verbose)
+        printblock(bp);
+      if (!GET_ALLOC(HDRP(bp)))
+        check_error(bp, "is a bad epilogue");
+    }
+  }
+
+  if (free_blocks != stats.free_blocks || free_bytes != stats.free_bytes)
+    check_error(NULL, "the free lists do not hold the free blocks of the heap");
+  if (largest != tree_max)
+    check_error(NULL, "the largest free block is not the one of tree_max");
+
+  /* Walk the lists, as far as there can be blocks on them */
+  for (i = 0; i < (int)QUICK_CLASSES; i++)
+    for (bp = quick_lists[i], n = 0; bp != NULL; bp = *(char **)bp) {
+      if (!is_block(bp) || !GET_ALLOC(HDRP(bp)) ||
+          GET_SIZE(HDRP(bp)) != i * DSIZE || ++n > allocated) {
+        check_error(bp, "is on a quick list but not one of its blocks");
+        break;
+      }
+      quick += GET_SIZE(HDRP(bp));
+    }
+  if (quick != stats.quick_bytes)
+    check_error(NULL, "the quick lists do not hold the bytes they count");
+  for (i = 0; i < (int)NUM_CLASSES; i++) {
+    if (!(class_map[i / MAP_BITS] & (1UL << (i % MAP_BITS))) != !seg_lists[i])
+      check_error(seg_lists[i], "heads a list the class map has wrong");
+    for (bp = seg_lists[i], n = 0; !ordered && bp != NULL; bp = GET_NEXT_PTR(bp))
+      if (!is_block(bp) || GET_ALLOC(HDRP(bp)) ||
+          size_class(GET_SIZE(HDRP(bp))) != i || ++n > free_blocks) {
+        check_error(bp, "is on a free list but not one of its blocks");
+        break;
+      }
   }
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of a free block.  The heap lock is held in
+ *   multithreaded mode.
+ *
+ * Effects:
+ *   Returns whether the block is in the right free list: linked to by its
+ *   neighbours in a list or chain, or else to be found from the root of
+ *   its tree.  A search of a tree does not splay it.
+ */
+static int in_free_list(char *bp){
+  size_t size = GET_SIZE(HDRP(bp));
+  char *prev = GET_PREV_PTR(bp), *next = GET_NEXT_PTR(bp), *t;
+  int c;
 
-  if (verbose)
-    printblock(bp);
-  if (GET_SIZE(HDRP(bp)) != 0 || !GET_ALLOC(HDRP(bp)))
-    printf("Bad epilogue header\n");
+  if ((prev != NULL && !is_block(prev)) || (next != NULL && !is_block(next)))
+    return 0;
+  if (size < LARGE_BLOCK && ordered) {
+    for (t = seg_lists[size_class(size)]; t != NULL && t != bp && is_block(t); )
+      t = bp < t ? GET_PREV_PTR(t) : GET_NEXT_PTR(t);
+    return t == bp;
+  }
+  if (next != NULL && GET_PREV_PTR(next) != bp)
+    return 0;
+  if (prev != NULL)
+    return GET_NEXT_PTR(prev) == bp;
+  if (size < LARGE_BLOCK)
+    return seg_lists[size_class(size)] == bp;
+  for (t = tree_root; t != NULL && is_block(t) && (c = tree_cmp(size, bp, t)) != 0; )
+    t = c < 0 ? GET_LEFT_PTR(t) : GET_RIGHT_PTR(t);
+  return t == bp;
+}
+
+/*
+ * Returns whether "bp" may be the address of a block of the heap, one
+ * with room for the pointers of a free block.
+ */
+static int is_block(char *bp){
+  return (uintptr_t)bp % DSIZE == 0 &&
+    mem_is_heap(HDRP(bp), bp + 2 * WSIZE - 1);
+}
+
+/* Reports what is wrong with block "bp", or with the heap if it is NULL */
+static void check_error(void *bp, char *msg){
+  if (bp != NULL)
+    fprintf(stderr, "Error: %p %s\n", bp, msg);
+  else
+    fprintf(stderr, "Error: %s\n", msg);
+  __atomic_add_fetch(&check_errors, 1, __ATOMIC_RELAXED);
 }
 
 /*
@@ -441,24 +2833,64 @@ checkheap(bool verbose)
 static void
 printblock(void *bp) 
 {
-  bool halloc, falloc;
-  size_t hsize, fsize;
+  bool alloc;
+  size_t size;
 
-  checkheap(false);
-  hsize = GET_SIZE(HDRP(bp));
-  halloc = GET_ALLOC(HDRP(bp));  
-  fsize = GET_SIZE(FTRP(bp));
-  falloc = GET_ALLOC(FTRP(bp));  
+  size = GET_SIZE(HDRP(bp));
+  alloc = GET_ALLOC(HDRP(bp));
 
-  if (hsize == 0) {
+  if (size == 0) {
     printf("%p: end of heap\n", bp);
     return;
   }
+  if (alloc)
+    printf("%p: header: [%zu:a]\n", bp, size);
+  else
+    printf("%p: header: [%zu:f] footer: [%zu:%c]\n", bp, size,
+        GET_SIZE(FTRP(bp)), (GET_ALLOC(FTRP(bp)) ? 'a' : 'f'));
+}
+
+#ifdef MM_DEBUG
+/*
+ * Requires:
+ *   The heap lock is held in multithreaded mode.
+ *
+ * Effects:
+ *   Check the blocks of the log, in address order, each with its boundary
+ *   to the next.  An address that is now inside a block checked before it
+ *   is no block any more, nor is one past the end of its arena any more.
+ */
+static void check_touched(void){
+  char *end = NULL, *bp;
+  int i;
+
+  sort_addrs((void **)touched, num_touched);
+  for (i = 0; i < num_touched; i++) {
+    bp = touched[i];
+    if (bp < end || !mem_is_heap(HDRP(bp), bp - 1) || GET_SIZE(HDRP(bp)) == 0)
+      continue;
+    if (checkblock(bp) == 0)
+      end = NEXT_BLK(bp);
+  }
+  for (i = 0; i < (int)NUM_CLASSES; i++)
+    if (!(class_map[i / MAP_BITS] & (1UL << (i % MAP_BITS))) != !seg_lists[i])
+      check_error(seg_lists[i], "heads a list the class map has wrong");
+}
+
+/* Reports a block or object being freed whose canary was overwritten */
+static void check_guard(void *bp, void *canary){
+  if (GET(canary) != CANARY(bp))
+    check_error(bp, "has lost its canary: its payload overflowed");
+}
 
-  printf("%p: header: [%zu:%c] footer: [%zu:%c]\n", bp, 
-      hsize, (halloc ? 'a' : 'f'), 
-      fsize, (falloc ? 'a' : 'f'));
+/* Logs a block that changed, for the next mm_check */
+static void touch(void *bp){
+  if (num_touched < TOUCH_MAX)
+    touched[num_touched++] = bp;
+  else
+    num_touched = TOUCH_MAX + 1;
 }
+#endif
 
 
 /*
@@ -5,8 +5,73 @@
 
 int mm_init(void);
 void *mm_malloc(size_t size);
+void *mm_calloc(size_t nmemb, size_t size);
+size_t mm_malloc_batch(size_t size, size_t n, void **ptrs);
 void mm_free(void *ptr);
+void mm_free_sized(void *ptr, size_t size);
+void mm_free_batch(void **ptrs, size_t n);
 void *mm_realloc(void *ptr, size_t size);
+void mm_set_threaded(int on);
+void mm_set_deferred(int on);
+void mm_set_address_ordered(int on);
+void *mm_memalign(size_t alignment, size_t size);
+void *mm_aligned_alloc(size_t alignment, size_t size);
+size_t mm_usable_size(void *ptr);
+void mm_fork_lock(void);
+void mm_fork_unlock(void);
+
+/*
+ * mm_set_line_aligned(n) puts every block of at least n bytes at the
+ * start of a cache line of MM_CACHE_LINE bytes.
+ */
+#define MM_CACHE_LINE 64
+
+void mm_set_line_aligned(size_t min_size);
+
+/*
+ * A region hands out blocks that all live until the region is destroyed,
+ * and that are never freed one by one.
+ */
+typedef struct mm_region mm_region_t;
+
+mm_region_t *mm_region_create(void);
+void *mm_region_alloc(mm_region_t *region, size_t size);
+void mm_region_destroy(mm_region_t *region);
+
+/*
+ * Statistics of the allocator, kept up to date as it runs.  Free bytes
+ * are broken down by block size: bin i counts the free blocks of less
+ * than 64 << i bytes that are not in a lower bin, and the last bin all
+ * the larger ones.
+ */
+#define MM_STAT_BINS 16
+
+typedef struct {
+    size_t heap_size;      /* bytes of heap, slab pages and huge blocks */
+    size_t in_use;         /* bytes of it not free: blocks, thread pages,
+			      and the overhead of the heap */
+    size_t free_bytes;     /* bytes in free heap blocks */
+    size_t free_blocks;    /* number of free heap blocks */
+    size_t quick_bytes;    /* bytes of freed blocks not yet coalesced */
+    size_t largest_free;   /* size of the largest free heap block */
+    size_t free_by_size[MM_STAT_BINS];
+    unsigned long sbrk_calls;        /* times the heap grew or shrank */
+    unsigned long splits;            /* blocks split in two */
+    unsigned long coalesces;         /* free blocks merged */
+    unsigned long realloc_in_place;  /* reallocs that kept the block */
+    unsigned long realloc_copies;    /* reallocs that moved the payload */
+} mm_stats_t;
+
+void mm_stats(mm_stats_t *st);
+
+/*
+ * mm_check(full) checks the heap for consistency, writes what is wrong
+ * with it to standard error, and returns 0 if nothing is and -1
+ * otherwise.  Built with MM_DEBUG defined, the allocator puts a canary
+ * behind every heap block, and mm_check(0) looks only at the blocks that
+ * changed since the last check.
+ */
+int mm_check(int full);
 
 /* 
  * Students work in teams of one or two.  Teams enter their team name, personal
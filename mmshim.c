@@ -0,0 +1,277 @@
+/*
+ * mmshim.c - Replace the C library's malloc with the allocator of mm.c
+ *
+ * Built together with mm.c and memlib.c as libmm.so, and loaded with
+ * LD_PRELOAD, this library defines the whole malloc family, so that
+ * a real program runs on the allocator:
+ *
+ *     LD_PRELOAD=./libmm.so app
+ *
+ * The allocator runs in multithreaded mode, on a heap set up by the
+ * first request (which may come before any constructor has run).
+ * Every entry point that the C library could otherwise serve from its
+ * own heap is defined here, since a block of one heap must never be
+ * freed to the other.  The heap lock is held across fork, so the
+ * child gets a heap in a consistent state.
+ *
+ * With MM_DEFER set in the environment, the allocator defers coalescing
+ * (see mm_set_deferred), and with MM_ORDERED set, it keeps its free lists
+ * in address order (see mm_set_address_ordered).  MM_LINE_ALIGN=n puts
+ * every block of at least n bytes on a cache line (see
+ * mm_set_line_aligned).  With MM_STATS set, the statistics of mm_stats
+ * are written to standard error at exit, one "name value" pair per line.
+ * MM_CHECK=n checks the heap with mm_check on every n-th free, and aborts
+ * the program once it finds the heap inconsistent; in a build with
+ * MM_DEBUG defined, for soak tests, the check is incremental and heap
+ * blocks carry canaries.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "memlib.h"
+#include "mm.h"
+
+/* Whether the heap is set up, and the lock under which that is done */
+static int ready = 0;
+static pthread_mutex_t init_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Check the heap every check_every frees, with frees counting them */
+static unsigned long check_every = 0;
+static unsigned long frees = 0;
+
+/* Function prototypes for internal helper routines */
+static int init(void);
+static void *alloc(size_t size);
+static void print_stats(void);
+static void soak_check(void);
+
+/*
+ * init - Set up the heap, once.  Returns 0 if the heap is ready, and -1
+ *     if it could not be set up.
+ */
+static int init(void)
+{
+    if (__atomic_load_n(&ready, __ATOMIC_ACQUIRE))
+	return 0;
+    pthread_mutex_lock(&init_lock);
+    if (!ready) {
+	mem_init();
+	if (mm_init() < 0) {
+	    pthread_mutex_unlock(&init_lock);
+	    return -1;
+	}
+	mm_set_threaded(1);
+	if (getenv("MM_DEFER") != NULL)
+	    mm_set_deferred(1);
+	if (getenv("MM_ORDERED") != NULL)
+	    mm_set_address_ordered(1);
+	if (getenv("MM_LINE_ALIGN") != NULL)
+	    mm_set_line_aligned(strtoul(getenv("MM_LINE_ALIGN"), NULL, 0));
+	if (getenv("MM_CHECK") != NULL)
+	    check_every = strtoul(getenv("MM_CHECK"), NULL, 0);
+	__atomic_store_n(&ready, 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&init_lock);
+    return 0;
+}
+
+/*
+ * setup - Set up the heap before main runs, and the fork handlers,
+ *     which cannot be registered from inside malloc
+ */
+static void __attribute__((constructor)) setup(void)
+{
+    if (init() < 0)
+	return;
+    pthread_atfork(mm_fork_lock, mm_fork_unlock, mm_fork_unlock);
+    if (getenv("MM_STATS") != NULL)
+	atexit(print_stats);
+}
+
+/*
+ * print_stats - Write the statistics of the allocator to stderr
+ */
+static void print_stats(void)
+{
+    mm_stats_t st;
+    int i;
+
+    mm_stats(&st);
+    fprintf(stderr, "heap_size %zu\nin_use %zu\nfree_bytes %zu\n"
+	    "free_blocks %zu\nquick_bytes %zu\nlargest_free %zu\n",
+	    st.heap_size, st.in_use, st.free_bytes, st.free_blocks,
+	    st.quick_bytes, st.largest_free);
+    for (i = 0; i < MM_STAT_BINS; i++)
+	fprintf(stderr, "free_by_size.%d %zu\n", i, st.free_by_size[i]);
+    fprintf(stderr, "sbrk_calls %lu\nsplits %lu\ncoalesces %lu\n"
+	    "realloc_in_place %lu\nrealloc_copies %lu\n",
+	    st.sbrk_calls, st.splits, st.coalesces, st.realloc_in_place,
+	    st.realloc_copies);
+}
+
+/*
+ * soak_check - Count a free, and check the heap on every check_every-th
+ *     one, aborting if it is inconsistent
+ */
+static void soak_check(void)
+{
+    if (check_every != 0 &&
+	__atomic_add_fetch(&frees, 1, __ATOMIC_RELAXED) % check_every == 0 &&
+	mm_check(0) < 0)
+	abort();
+}
+
+/*
+ * alloc - Allocate a block of at least size bytes, setting errno if
+ *     there is none.  Like the C library's, it hands out a block for a
+ *     request of 0 bytes, and fails any request larger than PTRDIFF_MAX.
+ */
+static void *alloc(size_t size)
+{
+    void *p;
+
+    if (size > PTRDIFF_MAX || init() < 0) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    if ((p = mm_malloc(size == 0 ? 1 : size)) == NULL)
+	errno = ENOMEM;
+    return p;
+}
+
+void *malloc(size_t size)
+{
+    return alloc(size);
+}
+
+void free(void *ptr)
+{
+    mm_free(ptr);
+    soak_check();
+}
+
+/*
+ * free_sized and free_aligned_sized - C23's frees of a block whose size
+ *     the caller knows; the size is not needed
+ */
+void free_sized(void *ptr, size_t size)
+{
+    mm_free_sized(ptr, size);
+    soak_check();
+}
+
+void free_aligned_sized(void *ptr, size_t alignment, size_t size)
+{
+    (void)alignment;
+    mm_free_sized(ptr, size);
+    soak_check();
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    void *p;
+
+    if (ptr == NULL)
+	return alloc(size);
+    if (size > PTRDIFF_MAX) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    if ((p = mm_realloc(ptr, size)) == NULL && size != 0)
+	errno = ENOMEM;
+    return p;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *p;
+
+    if (size != 0 && nmemb > SIZE_MAX / size) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    if (nmemb * size > PTRDIFF_MAX || init() < 0) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    if (nmemb == 0 || size == 0)
+	nmemb = size = 1;
+    if ((p = mm_calloc(nmemb, size)) == NULL)
+	errno = ENOMEM;
+    return p;
+}
+
+void *reallocarray(void *ptr, size_t nmemb, size_t size)
+{
+    if (size != 0 && nmemb > SIZE_MAX / size) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    return realloc(ptr, nmemb * size);
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    void *p;
+
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+	errno = EINVAL;
+	return NULL;
+    }
+    if (size > PTRDIFF_MAX || init() < 0) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    if ((p = mm_memalign(alignment, size == 0 ? 1 : size)) == NULL)
+	errno = ENOMEM;
+    return p;
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    void *p;
+    int saved = errno;
+
+    if (alignment % sizeof(void *) != 0)
+	return EINVAL;
+    if ((p = memalign(alignment, size)) == NULL) {
+	int err = errno;
+
+	errno = saved;
+	return err;
+    }
+    *memptr = p;
+    return 0;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    return memalign(alignment, size);
+}
+
+void *valloc(size_t size)
+{
+    return memalign(sysconf(_SC_PAGESIZE), size);
+}
+
+void *pvalloc(size_t size)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+
+    if (size > PTRDIFF_MAX) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    return memalign(page, (size + page - 1) & ~(page - 1));
+}
+
+size_t malloc_usable_size(void *ptr)
+{
+    return mm_usable_size(ptr);
+}
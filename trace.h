@@ -0,0 +1,35 @@
+/* 
+ * Trace requests, and the binary trace file format, shared by mdriver
+ * and the tools that write traces
+ */
+
+/* The first word of a binary trace: "MTR1" */
+#define BIN_MAGIC 0x3152544d
+
+/* 
+ * Characterizes a single trace operation (allocator request).  A BATCH
+ * request, "b <n>" in a text trace, makes the n requests after it one
+ * batch: they are all allocs of one size, made with mm_malloc_batch, or
+ * all frees, made with mm_free_batch.  A REGION_ALLOC request, "g <id>
+ * <size>", allocates a block from the region of the trace, which is
+ * created when needed, and REGION_FREE, "G", destroys the region with
+ * all its blocks.  A block of the region is never freed on its own.
+ */
+typedef struct {
+    enum {ALLOC, FREE, REALLOC, BATCH, REGION_ALLOC, REGION_FREE} type;
+    int index;                        /* index for free() to use later,
+					 or the length of a batch */
+    int size;                         /* byte size of alloc/realloc request */
+} traceop_t;
+
+/* 
+ * Header of a binary trace file.  It is followed by num_ops traceop_t
+ * records, exactly as they are laid out in memory, so the file can be
+ * mapped and replayed without parsing or copying it.
+ */
+typedef struct {
+    uint32_t magic;    /* BIN_MAGIC, which also catches a wrong byte order */
+    uint32_t num_ids;  /* number of alloc/realloc ids */
+    uint32_t num_ops;  /* number of distinct requests */
+    uint32_t weight;   /* weight for this trace (unused) */
+} binhdr_t;